@@ -0,0 +1,551 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <strings.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "filter.h"
+
+// External functions from image.c
+long get_time_ms();
+
+// External functions from main.c
+int apply_operation(const char* operation, const char* arg, float sigma, Image* src, Image* dst,
+                    ThreadPool* pool, int verbose);
+
+// Frames in flight between two stages. Bounds memory to a few decoded frames
+// while still letting decode and encode run ahead of or behind the filter.
+#define BATCH_QUEUE_DEPTH 4
+
+// Frame buffers per side of run_stream: one being read or written while the
+// filter works on the other
+#define STREAM_BUFFERS 2
+
+// Interval of run_stream's progress lines
+#define STREAM_REPORT_MS 1000
+
+typedef struct {
+    Image* image;
+    int index;  // Position in the input list, also picks the output path
+} Frame;
+
+// Bounded single-producer single-consumer queue of frames. A frame with a
+// NULL image is the end-of-stream marker.
+typedef struct {
+    Frame slots[BATCH_QUEUE_DEPTH];
+    int head;
+    int count;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} FrameQueue;
+
+typedef struct {
+    char** inputs;
+    char** outputs;
+    int count;
+    int png_level;
+    PngFilter png_filter;
+    FrameQueue decoded;
+    FrameQueue filtered;
+
+    // Per-stage busy time and failures, each written by one stage only
+    long decode_ms;
+    long encode_ms;
+    int failed_loads;
+    int failed_saves;
+
+    // Set by the filter stage when the operation itself is invalid
+    _Atomic int cancel;
+} Batch;
+
+static void queue_init(FrameQueue* queue) {
+    queue->head = 0;
+    queue->count = 0;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+}
+
+static void queue_destroy(FrameQueue* queue) {
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_cond_destroy(&queue->not_full);
+}
+
+static void queue_push(FrameQueue* queue, Frame frame) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == BATCH_QUEUE_DEPTH) {
+        pthread_cond_wait(&queue->not_full, &queue->lock);
+    }
+    queue->slots[(queue->head + queue->count) % BATCH_QUEUE_DEPTH] = frame;
+    queue->count++;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static Frame queue_pop(FrameQueue* queue) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0) {
+        pthread_cond_wait(&queue->not_empty, &queue->lock);
+    }
+    Frame frame = queue->slots[queue->head];
+    queue->head = (queue->head + 1) % BATCH_QUEUE_DEPTH;
+    queue->count--;
+    pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue->lock);
+    return frame;
+}
+
+static void free_frame_image(Image* img) {
+    free(img->data);
+    free(img);
+}
+
+// Decode stage: load every input in order, skipping files that fail
+static void* decode_thread(void* arg) {
+    Batch* batch = (Batch*)arg;
+
+    for (int i = 0; i < batch->count && !atomic_load(&batch->cancel); i++) {
+        long start = get_time_ms();
+        Image* img = load_image(batch->inputs[i]);
+        batch->decode_ms += get_time_ms() - start;
+
+        if (!img) {
+            fprintf(stderr, "Failed to load image: %s\n", batch->inputs[i]);
+            batch->failed_loads++;
+            continue;
+        }
+        Frame frame = {img, i};
+        queue_push(&batch->decoded, frame);
+    }
+
+    Frame end = {NULL, -1};
+    queue_push(&batch->decoded, end);
+    return NULL;
+}
+
+// Encode stage: save filtered frames as they arrive. The pool belongs to the
+// filter stage, so each PNG is encoded serially on this thread.
+static void* encode_thread(void* arg) {
+    Batch* batch = (Batch*)arg;
+
+    for (;;) {
+        Frame frame = queue_pop(&batch->filtered);
+        if (!frame.image) break;
+
+        long start = get_time_ms();
+        if (!save_png(batch->outputs[frame.index], frame.image, batch->png_level, batch->png_filter, NULL)) {
+            fprintf(stderr, "Failed to save image: %s\n", batch->outputs[frame.index]);
+            batch->failed_saves++;
+        }
+        batch->encode_ms += get_time_ms() - start;
+        free_frame_image(frame.image);
+    }
+    return NULL;
+}
+
+static int has_image_extension(const char* name) {
+    const char* dot = strrchr(name, '.');
+    if (!dot) return 0;
+    const char* extensions[] = {".png", ".jpg", ".jpeg", ".bmp", ".tga", ".ppm", ".pgm", ".pam"};
+    for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++) {
+        if (strcasecmp(dot, extensions[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+static int compare_paths(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static void append_path(char*** paths, int* count, int* capacity, char* path) {
+    if (*count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        *paths = (char**)realloc(*paths, *capacity * sizeof(char*));
+    }
+    (*paths)[(*count)++] = path;
+}
+
+// Collect the images of a directory (sorted by name) or the paths listed one
+// per line in a text file. Returns the number of paths, -1 on error.
+static int list_inputs(const char* input, char*** paths) {
+    int count = 0;
+    int capacity = 0;
+    *paths = NULL;
+
+    struct stat st;
+    if (stat(input, &st) != 0) {
+        fprintf(stderr, "Cannot open batch input: %s\n", input);
+        return -1;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        DIR* dir = opendir(input);
+        if (!dir) {
+            fprintf(stderr, "Cannot open batch input: %s\n", input);
+            return -1;
+        }
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (entry->d_name[0] == '.' || !has_image_extension(entry->d_name)) continue;
+            size_t len = strlen(input) + strlen(entry->d_name) + 2;
+            char* path = (char*)malloc(len);
+            snprintf(path, len, "%s/%s", input, entry->d_name);
+            append_path(paths, &count, &capacity, path);
+        }
+        closedir(dir);
+        if (count > 0) qsort(*paths, count, sizeof(char*), compare_paths);
+        return count;
+    }
+
+    FILE* list = fopen(input, "r");
+    if (!list) {
+        fprintf(stderr, "Cannot open batch input: %s\n", input);
+        return -1;
+    }
+    char line[4096];
+    while (fgets(line, sizeof(line), list)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0') continue;
+        append_path(paths, &count, &capacity, strdup(line));
+    }
+    fclose(list);
+    return count;
+}
+
+// Output path for an input: same base name in output_dir, saved as PNG
+static char* output_path_for(const char* input, const char* output_dir) {
+    const char* base = strrchr(input, '/');
+    base = base ? base + 1 : input;
+    const char* dot = strrchr(base, '.');
+    int stem = dot ? (int)(dot - base) : (int)strlen(base);
+
+    size_t len = strlen(output_dir) + stem + 6;
+    char* path = (char*)malloc(len);
+    snprintf(path, len, "%s/%.*s.png", output_dir, stem, base);
+    return path;
+}
+
+// Filter every image of input (a directory or a list file) into output_dir.
+// Decoding and encoding run on their own threads, connected to the filter
+// stage on the calling thread by bounded queues, so PNG I/O for neighbouring
+// frames overlaps with filtering. Returns 0 if nothing could be processed.
+int run_batch(const char* operation, const char* input, const char* output_dir,
+              const char* arg, float sigma, int png_level, PngFilter png_filter, ThreadPool* pool) {
+    Batch batch = {
+        .png_level = png_level,
+        .png_filter = png_filter
+    };
+    batch.count = list_inputs(input, &batch.inputs);
+    if (batch.count < 0) return 0;
+    if (batch.count == 0) {
+        fprintf(stderr, "No images found in: %s\n", input);
+        free(batch.inputs);
+        return 0;
+    }
+
+    if (mkdir(output_dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Cannot create output directory: %s\n", output_dir);
+        for (int i = 0; i < batch.count; i++) free(batch.inputs[i]);
+        free(batch.inputs);
+        return 0;
+    }
+
+    batch.outputs = (char**)malloc(batch.count * sizeof(char*));
+    for (int i = 0; i < batch.count; i++) {
+        batch.outputs[i] = output_path_for(batch.inputs[i], output_dir);
+    }
+
+    printf("Batch of %d images using %d workers\n", batch.count, thread_pool_size(pool));
+
+    queue_init(&batch.decoded);
+    queue_init(&batch.filtered);
+
+    long start_time = get_time_ms();
+    pthread_t decoder, encoder;
+    pthread_create(&decoder, NULL, decode_thread, &batch);
+    pthread_create(&encoder, NULL, encode_thread, &batch);
+
+    // Filter stage on the calling thread, which owns the pool
+    long filter_ms = 0;
+    int filtered = 0;
+    for (;;) {
+        Frame frame = queue_pop(&batch.decoded);
+        if (!frame.image) break;
+
+        Image* src = frame.image;
+        if (atomic_load(&batch.cancel)) {
+            free_image(src);
+            continue;
+        }
+
+        Image* dst = (Image*)malloc(sizeof(Image));
+        dst->width = src->width;
+        dst->height = src->height;
+        dst->channels = src->channels;
+        dst->stride = (size_t)src->width * src->channels;
+        size_t frame_bytes = (size_t)src->width * src->height * src->channels;
+        dst->data = (unsigned char*)malloc(frame_bytes);
+        thread_pool_first_touch(pool, dst->data, frame_bytes);
+
+        long start = get_time_ms();
+        int ok = apply_operation(operation, arg, sigma, src, dst, pool, 0);
+        filter_ms += get_time_ms() - start;
+        free_image(src);
+
+        if (!ok) {
+            // Unknown operation or bad argument: every frame would fail the same way
+            atomic_store(&batch.cancel, 1);
+            free_frame_image(dst);
+            continue;
+        }
+        Frame out = {dst, frame.index};
+        queue_push(&batch.filtered, out);
+        filtered++;
+    }
+
+    Frame end = {NULL, -1};
+    queue_push(&batch.filtered, end);
+    pthread_join(decoder, NULL);
+    pthread_join(encoder, NULL);
+    long total_ms = get_time_ms() - start_time;
+
+    int done = filtered - batch.failed_saves;
+    printf("Processed %d of %d images (%d load, %d save failures)\n", done, batch.count,
+           batch.failed_loads, batch.failed_saves);
+    printf("Decode time: %ldms\n", batch.decode_ms);
+    printf("Filter time: %ldms\n", filter_ms);
+    printf("Encode time: %ldms\n", batch.encode_ms);
+    printf("Total time: %ldms\n", total_ms);
+
+    queue_destroy(&batch.decoded);
+    queue_destroy(&batch.filtered);
+    for (int i = 0; i < batch.count; i++) {
+        free(batch.inputs[i]);
+        free(batch.outputs[i]);
+    }
+    free(batch.inputs);
+    free(batch.outputs);
+
+    return done > 0 && !atomic_load(&batch.cancel);
+}
+
+typedef struct {
+    int fd_in;
+    int fd_out;
+    size_t frame_bytes;
+    FrameQueue free_inputs;   // Empty input buffers, back from the filter stage
+    FrameQueue read;          // Frames read from fd_in
+    FrameQueue free_outputs;  // Output buffers, back from the writer
+    FrameQueue filtered;      // Frames waiting for fd_out
+
+    // Time spent in read() and write(), each written by one thread only
+    long read_ms;
+    long write_ms;
+    int write_failed;
+
+    _Atomic int cancel;
+} Stream;
+
+// Fill buf from fd, returns the number of bytes read (short only at end of
+// input) or -1 on error
+static long read_full(int fd, unsigned char* buf, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = read(fd, buf + done, size - done);
+        if (n == 0) break;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    return (long)done;
+}
+
+static int write_full(int fd, const unsigned char* buf, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = write(fd, buf + done, size - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        done += (size_t)n;
+    }
+    return 1;
+}
+
+// Read stage: fill free input buffers with whole frames until end of input
+static void* stream_read_thread(void* arg) {
+    Stream* stream = (Stream*)arg;
+
+    for (int i = 0; !atomic_load(&stream->cancel); i++) {
+        Frame frame = queue_pop(&stream->free_inputs);
+        long start = get_time_ms();
+        long got = read_full(stream->fd_in, frame.image->data, stream->frame_bytes);
+        stream->read_ms += get_time_ms() - start;
+
+        if (got != (long)stream->frame_bytes) {
+            if (got < 0) fprintf(stderr, "Failed to read frame %d: %s\n", i, strerror(errno));
+            if (got > 0) fprintf(stderr, "Dropped incomplete frame %d (%ld bytes)\n", i, got);
+            break;
+        }
+        frame.index = i;
+        queue_push(&stream->read, frame);
+    }
+
+    Frame end = {NULL, -1};
+    queue_push(&stream->read, end);
+    return NULL;
+}
+
+// Write stage: send filtered frames in order and hand their buffers back.
+// After a failed write (the reader of fd_out went away) frames are dropped,
+// but buffers keep flowing so the filter stage never blocks.
+static void* stream_write_thread(void* arg) {
+    Stream* stream = (Stream*)arg;
+
+    for (;;) {
+        Frame frame = queue_pop(&stream->filtered);
+        if (!frame.image) break;
+
+        if (!stream->write_failed) {
+            long start = get_time_ms();
+            if (!write_full(stream->fd_out, frame.image->data, stream->frame_bytes)) {
+                fprintf(stderr, "Failed to write frame %d: %s\n", frame.index, strerror(errno));
+                stream->write_failed = 1;
+                atomic_store(&stream->cancel, 1);
+            }
+            stream->write_ms += get_time_ms() - start;
+        }
+        queue_push(&stream->free_outputs, frame);
+    }
+    return NULL;
+}
+
+static Image* alloc_frame(int width, int height, int channels) {
+    Image* img = (Image*)malloc(sizeof(Image));
+    img->width = width;
+    img->height = height;
+    img->channels = channels;
+    img->stride = (size_t)width * channels;
+    img->data = (unsigned char*)malloc((size_t)width * height * channels);
+    return img;
+}
+
+// Filter raw frames from stdin to stdout, e.g. from and to ffmpeg's rawvideo
+// format. size is "<width>x<height>" for RGBA or "<width>x<height>x<channels>"
+// for 1 (gray) or 3 (rgb24) channel frames. Reading and writing run on their
+// own threads over STREAM_BUFFERS reused buffers each, so I/O of the next and
+// previous frame overlaps the filter, which keeps the pool between frames.
+// Progress goes to stderr since stdout carries the frames. Returns 0 on a bad
+// size, an invalid operation or a failed write.
+int run_stream(const char* operation, const char* size, const char* arg, float sigma, ThreadPool* pool) {
+    int width = 0, height = 0, channels = 4;
+    int fields = sscanf(size, "%dx%dx%d", &width, &height, &channels);
+    if (fields < 2 || width <= 0 || height <= 0 || (channels != 1 && channels != 3 && channels != 4)) {
+        fprintf(stderr, "Invalid frame size: %s (expected e.g. 1920x1080 or 1920x1080x3)\n", size);
+        return 0;
+    }
+
+    // The filters never print and apply_operation is quiet here, so stdout
+    // carries nothing but frames
+    Stream stream = {
+        .fd_in = STDIN_FILENO,
+        .fd_out = STDOUT_FILENO,
+        .frame_bytes = (size_t)width * height * channels
+    };
+    queue_init(&stream.free_inputs);
+    queue_init(&stream.read);
+    queue_init(&stream.free_outputs);
+    queue_init(&stream.filtered);
+
+    Image* buffers[2 * STREAM_BUFFERS];
+    for (int i = 0; i < 2 * STREAM_BUFFERS; i++) {
+        buffers[i] = alloc_frame(width, height, channels);
+        Frame frame = {buffers[i], -1};
+        if (i < STREAM_BUFFERS) {
+            queue_push(&stream.free_inputs, frame);
+        } else {
+            // Outputs are written by the pool, let its workers place the pages
+            thread_pool_first_touch(pool, buffers[i]->data, stream.frame_bytes);
+            queue_push(&stream.free_outputs, frame);
+        }
+    }
+
+    // A closed downstream pipe shows up as a failed write, not a signal
+    signal(SIGPIPE, SIG_IGN);
+    fprintf(stderr, "Streaming %dx%d frames, %d channels, using %d workers\n", width, height, channels,
+            thread_pool_size(pool));
+
+    long start_time = get_time_ms();
+    pthread_t reader, writer;
+    pthread_create(&reader, NULL, stream_read_thread, &stream);
+    pthread_create(&writer, NULL, stream_write_thread, &stream);
+
+    // Filter stage on the calling thread, which owns the pool
+    long filter_ms = 0;
+    long last_report = start_time;
+    int frames = 0;
+    int failed = 0;
+    for (;;) {
+        Frame in = queue_pop(&stream.read);
+        if (!in.image) break;
+        if (atomic_load(&stream.cancel)) {
+            queue_push(&stream.free_inputs, in);
+            continue;
+        }
+
+        Frame out = queue_pop(&stream.free_outputs);
+        out.index = in.index;
+        long start = get_time_ms();
+        int ok = apply_operation(operation, arg, sigma, in.image, out.image, pool, 0);
+        filter_ms += get_time_ms() - start;
+        queue_push(&stream.free_inputs, in);
+
+        if (!ok) {
+            // Unknown operation or bad argument: every frame would fail the same way
+            failed = 1;
+            atomic_store(&stream.cancel, 1);
+            queue_push(&stream.free_outputs, out);
+            continue;
+        }
+        queue_push(&stream.filtered, out);
+        frames++;
+
+        long now = get_time_ms();
+        if (now - last_report >= STREAM_REPORT_MS) {
+            fprintf(stderr, "Frame %d: %.1f fps\n", frames, frames * 1000.0 / (now - start_time));
+            last_report = now;
+        }
+    }
+
+    Frame end = {NULL, -1};
+    queue_push(&stream.filtered, end);
+    pthread_join(reader, NULL);
+    pthread_join(writer, NULL);
+    long total_ms = get_time_ms() - start_time;
+
+    fprintf(stderr, "Streamed %d frames in %ldms: %.1f fps\n", frames, total_ms,
+            total_ms > 0 ? frames * 1000.0 / total_ms : 0.0);
+    fprintf(stderr, "Read time: %ldms\n", stream.read_ms);
+    fprintf(stderr, "Filter time: %ldms\n", filter_ms);
+    fprintf(stderr, "Write time: %ldms\n", stream.write_ms);
+
+    queue_destroy(&stream.free_inputs);
+    queue_destroy(&stream.read);
+    queue_destroy(&stream.free_outputs);
+    queue_destroy(&stream.filtered);
+    for (int i = 0; i < 2 * STREAM_BUFFERS; i++) free_frame_image(buffers[i]);
+    close(stream.fd_out);
+
+    return !failed && !stream.write_failed;
+}
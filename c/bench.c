@@ -0,0 +1,313 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "filter.h"
+
+#define MAX_LIST 32
+
+// Operations run when --ops is not given
+#define DEFAULT_OPS "blur,kuwahara,monte_carlo"
+
+typedef enum {
+    BENCH_BLUR,
+    BENCH_KUWAHARA,
+    BENCH_GENERALIZED_KUWAHARA,
+    BENCH_MONTE_CARLO
+} BenchKind;
+
+typedef struct {
+    const char* name;
+    BenchKind kind;
+    int mode;  // BlurMode, KuwaharaMode or MonteCarloRng
+} BenchOp;
+
+// Looked up by name only, for --ops and DEFAULT_OPS, so new modes can sit
+// next to the rest of their family
+static const BenchOp bench_ops[] = {
+    {"blur", BENCH_BLUR, BLUR_TRANSPOSE},
+    {"blur_fused", BENCH_BLUR, BLUR_FUSED},
+    {"blur_fixed", BENCH_BLUR, BLUR_FIXED},
+    {"blur_box", BENCH_BLUR, BLUR_BOX},
+    {"blur_tiled", BENCH_BLUR, BLUR_TILED},
+    {"blur_graph", BENCH_BLUR, BLUR_GRAPH},
+    {"kuwahara", BENCH_KUWAHARA, KUWAHARA_FULL_SAT},
+    {"kuwahara_banded", BENCH_KUWAHARA, KUWAHARA_BANDED},
+    {"kuwahara_generalized", BENCH_GENERALIZED_KUWAHARA, 0},
+    {"monte_carlo", BENCH_MONTE_CARLO, MC_RNG_LCG},
+    {"monte_carlo_splitmix", BENCH_MONTE_CARLO, MC_RNG_SPLITMIX},
+    {"monte_carlo_lcg8", BENCH_MONTE_CARLO, MC_RNG_LCG8}
+};
+
+typedef struct {
+    int width;
+    int height;  // 0 x 0 means the input's own size
+} BenchSize;
+
+typedef struct {
+    const BenchOp* ops[MAX_LIST];
+    int num_ops;
+    int radii[MAX_LIST];
+    int num_radii;
+    int workers[MAX_LIST];
+    int num_workers;
+    BenchSize sizes[MAX_LIST];
+    int num_sizes;
+    int repeat;
+    long samples;
+    int json;
+} BenchConfig;
+
+static long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static int compare_long(const void* a, const void* b) {
+    long x = *(const long*)a;
+    long y = *(const long*)b;
+    return (x > y) - (x < y);
+}
+
+// Split a comma-separated list, calling parse on each item. Returns the
+// number of items or -1 if one fails to parse.
+static int parse_list(const char* text, int max, int (*parse)(const char* item, void* out, int index),
+                      void* out) {
+    char buffer[512];
+    snprintf(buffer, sizeof(buffer), "%s", text);
+    int count = 0;
+    for (char* item = strtok(buffer, ","); item; item = strtok(NULL, ",")) {
+        if (count == max || !parse(item, out, count)) return -1;
+        count++;
+    }
+    return count;
+}
+
+static int parse_int_item(const char* item, void* out, int index) {
+    int value = atoi(item);
+    ((int*)out)[index] = value;
+    return value > 0;
+}
+
+static int parse_op_item(const char* item, void* out, int index) {
+    for (size_t i = 0; i < sizeof(bench_ops) / sizeof(bench_ops[0]); i++) {
+        if (strcmp(item, bench_ops[i].name) == 0) {
+            ((const BenchOp**)out)[index] = &bench_ops[i];
+            return 1;
+        }
+    }
+    fprintf(stderr, "Unknown operation: %s\n", item);
+    return 0;
+}
+
+static int parse_size_item(const char* item, void* out, int index) {
+    BenchSize* size = &((BenchSize*)out)[index];
+    if (strcmp(item, "native") == 0) {
+        size->width = 0;
+        size->height = 0;
+        return 1;
+    }
+    return sscanf(item, "%dx%d", &size->width, &size->height) == 2 && size->width > 0 && size->height > 0;
+}
+
+// Nearest-neighbour resample, so one input covers any benchmark size
+static Image* resize_image(Image* src, int width, int height) {
+    Image* img = (Image*)malloc(sizeof(Image));
+    img->width = width;
+    img->height = height;
+    int cn = src->channels;
+    img->channels = cn;
+    img->stride = (size_t)width * cn;
+    img->data = (unsigned char*)malloc((size_t)width * height * cn);
+
+    for (int y = 0; y < height; y++) {
+        int sy = (int)((long)y * src->height / height);
+        for (int x = 0; x < width; x++) {
+            int sx = (int)((long)x * src->width / width);
+            memcpy(img->data + ((size_t)y * width + x) * cn, image_row(src, sy) + (size_t)sx * cn, cn);
+        }
+    }
+    return img;
+}
+
+static void run_op(const BenchOp* op, Image* src, Image* dst, int radius, long samples, ThreadPool* pool) {
+    switch (op->kind) {
+        case BENCH_BLUR: gaussian_blur(src, dst, radius, (BlurMode)op->mode, pool); break;
+        case BENCH_KUWAHARA: apply_kuwahara_filter(src, dst, radius, (KuwaharaMode)op->mode, pool); break;
+        case BENCH_GENERALIZED_KUWAHARA: apply_generalized_kuwahara(src, dst, radius, pool); break;
+        case BENCH_MONTE_CARLO: monte_carlo_operation(samples, (MonteCarloRng)op->mode, pool); break;
+    }
+}
+
+// One untimed warm-up run (page faults, scratch buffers, caches), then
+// config->repeat timed runs
+static void bench_case(FILE* out, BenchConfig* config, const BenchOp* op, Image* src, Image* dst,
+                       int radius, int workers, ThreadPool* pool, int* first) {
+    long* times = (long*)malloc(config->repeat * sizeof(long));
+
+    run_op(op, src, dst, radius, config->samples, pool);
+    for (int i = 0; i < config->repeat; i++) {
+        long start = now_ns();
+        run_op(op, src, dst, radius, config->samples, pool);
+        times[i] = now_ns() - start;
+    }
+    qsort(times, config->repeat, sizeof(long), compare_long);
+
+    int n = config->repeat;
+    double median = (n % 2) ? times[n / 2] : (times[n / 2 - 1] + times[n / 2]) / 2.0;
+    int p99_rank = (99 * n + 99) / 100;  // Nearest rank, ceil(0.99 n)
+    double p99 = times[p99_rank - 1];
+
+    int monte_carlo = op->kind == BENCH_MONTE_CARLO;
+    double items = monte_carlo ? (double)config->samples : (double)src->width * src->height;
+    double throughput = items / (median / 1e9) / 1e6;
+    const char* unit = monte_carlo ? "Msamples/s" : "Mpixels/s";
+    int width = monte_carlo ? 0 : src->width;
+    int height = monte_carlo ? 0 : src->height;
+    int r = monte_carlo ? 0 : radius;
+
+    if (config->json) {
+        fprintf(out, "%s\n  {\"operation\": \"%s\", \"width\": %d, \"height\": %d, \"radius\": %d, "
+                "\"workers\": %d, \"runs\": %d, \"median_us\": %.1f, \"p99_us\": %.1f, "
+                "\"min_us\": %.1f, \"throughput\": %.2f, \"unit\": \"%s\"}",
+                *first ? "" : ",", op->name, width, height, r, workers, n, median / 1e3, p99 / 1e3,
+                times[0] / 1e3, throughput, unit);
+    } else {
+        fprintf(out, "%s,%d,%d,%d,%d,%d,%.1f,%.1f,%.1f,%.2f,%s\n", op->name, width, height, r, workers, n,
+                median / 1e3, p99 / 1e3, times[0] / 1e3, throughput, unit);
+    }
+    fflush(out);
+    *first = 0;
+    free(times);
+}
+
+static void print_usage(const char* program) {
+    fprintf(stderr, "Usage: %s <input_image> [options]\n", program);
+    fprintf(stderr, "Times filters in-process, excluding image load and save.\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  --ops=<list>      operations, e.g. blur,blur_fused,kuwahara,monte_carlo\n");
+    fprintf(stderr, "                    (default: " DEFAULT_OPS ")\n");
+    fprintf(stderr, "                    available:");
+    for (size_t i = 0; i < sizeof(bench_ops) / sizeof(bench_ops[0]); i++) {
+        fprintf(stderr, "%s%s", i ? "," : " ", bench_ops[i].name);
+    }
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  --radii=<list>    filter radii (default: 5)\n");
+    fprintf(stderr, "  --workers=<list>  worker counts (default: 1 and the number of CPUs)\n");
+    fprintf(stderr, "  --sizes=<list>    image sizes as WxH or 'native', resampled from the input\n");
+    fprintf(stderr, "                    (default: native)\n");
+    fprintf(stderr, "  --repeat=<n>      timed runs per case (default: 10)\n");
+    fprintf(stderr, "  --samples=<n>     Monte Carlo samples per run (default: 10000000)\n");
+    fprintf(stderr, "  --format=<csv|json>  (default: csv)\n");
+}
+
+static int parse_config(int argc, char* argv[], BenchConfig* config) {
+    for (int i = 0; i < argc; i++) {
+        const char* arg = argv[i];
+        if (strncmp(arg, "--ops=", 6) == 0) {
+            config->num_ops = parse_list(arg + 6, MAX_LIST, parse_op_item, config->ops);
+            if (config->num_ops <= 0) return 0;
+        } else if (strncmp(arg, "--radii=", 8) == 0) {
+            config->num_radii = parse_list(arg + 8, MAX_LIST, parse_int_item, config->radii);
+            if (config->num_radii <= 0) return 0;
+        } else if (strncmp(arg, "--workers=", 10) == 0) {
+            config->num_workers = parse_list(arg + 10, MAX_LIST, parse_int_item, config->workers);
+            if (config->num_workers <= 0) return 0;
+        } else if (strncmp(arg, "--sizes=", 8) == 0) {
+            config->num_sizes = parse_list(arg + 8, MAX_LIST, parse_size_item, config->sizes);
+            if (config->num_sizes <= 0) return 0;
+        } else if (strncmp(arg, "--repeat=", 9) == 0) {
+            config->repeat = atoi(arg + 9);
+            if (config->repeat <= 0) return 0;
+        } else if (strncmp(arg, "--samples=", 10) == 0) {
+            config->samples = strtol(arg + 10, NULL, 10);
+            if (config->samples <= 0) return 0;
+        } else if (strcmp(arg, "--format=json") == 0) {
+            config->json = 1;
+        } else if (strcmp(arg, "--format=csv") == 0) {
+            config->json = 0;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", arg);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig config = {
+        .num_radii = 1,
+        .radii = {5},
+        .num_sizes = 1,
+        .sizes = {{0, 0}},
+        .repeat = 10,
+        .samples = 10000000
+    };
+    config.num_ops = parse_list(DEFAULT_OPS, MAX_LIST, parse_op_item, config.ops);
+    int cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    config.workers[0] = 1;
+    config.num_workers = cpus > 1 ? 2 : 1;
+    config.workers[1] = cpus;
+
+    if (argc < 2 || !parse_config(argc - 2, argv + 2, &config)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    Image* input = load_image(argv[1]);
+    if (!input) {
+        fprintf(stderr, "Failed to load image: %s\n", argv[1]);
+        return 1;
+    }
+
+    FILE* out = stdout;
+
+    if (config.json) {
+        fprintf(out, "[");
+    } else {
+        fprintf(out, "operation,width,height,radius,workers,runs,median_us,p99_us,min_us,throughput,unit\n");
+    }
+
+    int first = 1;
+    for (int s = 0; s < config.num_sizes; s++) {
+        BenchSize size = config.sizes[s];
+        Image* src = size.width ? resize_image(input, size.width, size.height) : input;
+        Image dst = {
+            .data = (unsigned char*)malloc((size_t)src->width * src->height * src->channels),
+            .width = src->width,
+            .height = src->height,
+            .channels = src->channels
+        };
+
+        for (int w = 0; w < config.num_workers; w++) {
+            ThreadPool* pool = thread_pool_create(config.workers[w]);
+            for (int o = 0; o < config.num_ops; o++) {
+                const BenchOp* op = config.ops[o];
+                if (op->kind == BENCH_MONTE_CARLO) {
+                    // Independent of image size and radius, run once per worker count
+                    if (s == 0) bench_case(out, &config, op, src, &dst, 0, config.workers[w], pool, &first);
+                    continue;
+                }
+                for (int r = 0; r < config.num_radii; r++) {
+                    bench_case(out, &config, op, src, &dst, config.radii[r], config.workers[w], pool, &first);
+                }
+            }
+            thread_pool_destroy(pool);
+        }
+
+        free(dst.data);
+        if (src != input) {
+            free(src->data);
+            free(src);
+        }
+    }
+
+    if (config.json) {
+        fprintf(out, "\n]\n");
+    }
+    free_image(input);
+    return 0;
+}
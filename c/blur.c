@@ -1,35 +1,96 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <math.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 
-typedef struct {
-    unsigned char* data;
-    int width;
-    int height;
-    int channels;
-} Image;
+#include "filter.h"
+#include "filter_internal.h"
+
+typedef void (*PoolTaskFn)(void* arg, int worker);
+typedef void (*PoolRangeFn)(void* arg, int begin, int end, int worker);
+
+// External functions from thread_pool.c
+void thread_pool_run(ThreadPool* pool, PoolTaskFn task, void* arg);
+void thread_pool_for(ThreadPool* pool, int count, PoolRangeFn body, void* arg);
+void thread_pool_set_phase(ThreadPool* pool, const char* name);
+void* thread_pool_buffer(ThreadPool* pool, int slot, size_t size);
+
+// External functions from blur_simd.c
+BlurRowFn blur_select_row_kernel(void);
+BlurRowFixedFn blur_select_row_kernel_fixed(void);
+
+// Box passes per direction approximating the Gaussian in BLUR_BOX mode
+#define BOX_PASSES 3
 
 typedef struct {
     Image* src;
     Image* dst;
     float* kernel;
     int radius;
-    int start_row;
-    int end_row;
+    BlurRowFn row_kernel;  // Vectorized interior of blur_horizontal, NULL for scalar
+    int16_t* kernel_fixed;  // Q14 weights, set when blurring in fixed point
+    BlurRowFixedFn row_kernel_fixed;
+    int box_radius[BOX_PASSES];  // Per-pass radii for BLUR_BOX
+    ImageRect rect;  // Window of the region workers, rows relative to rect.y
+    unsigned char* worker_scratch;  // worker_scratch_bytes per worker: BLUR_TILED bands, BLUR_BOX rows
+    size_t worker_scratch_bytes;
+    int tile_rows;
 } WorkerContext;
 
-// Generate Gaussian kernel
-float* generate_gaussian_kernel(int radius) {
+// Pixels per side of a transpose block (16 RGBA pixels = one 64-byte line)
+#define TRANSPOSE_BLOCK 16
+
+// Pixels per column strip of the direct vertical pass (1 KB of accumulators)
+#define VERTICAL_STRIP 64
+
+// Pool scratch slots holding the full-frame temporaries of gaussian_blur
+#define BLUR_SLOT_HORIZONTAL 0
+#define BLUR_SLOT_TRANSPOSED 1
+#define BLUR_SLOT_TRANSPOSED_BLURRED 2
+#define BLUR_SLOT_WORKERS 3  // Per-worker scratch, see WorkerContext
+#define BLUR_SLOT_FIXED_KERNEL 4
+#define BLUR_SLOT_GRAPH 5  // BLUR_GRAPH's per-strip counters
+
+// Target size of one BLUR_TILED band buffer, halo rows included, so the
+// horizontal result is still in a core's L2 when the vertical pass reads it
+#define TILE_BYTES (256 * 1024)
+#define TILE_MIN_ROWS 16
+
+// BLUR_GRAPH strips per worker, more strips give late workers more to share
+#define GRAPH_STRIPS_PER_WORKER 8
+#define GRAPH_MIN_STRIP_ROWS 8
+
+// Kernels kept by gaussian_kernel_acquire, enough for every radius and sigma
+// a program realistically alternates between
+#define KERNEL_CACHE_SIZE 32
+
+typedef struct {
+    int radius;
+    float sigma;
+    float* weights;
+} CachedKernel;
+
+static CachedKernel kernel_cache[KERNEL_CACHE_SIZE];
+static int kernel_cache_count = 0;
+static pthread_mutex_t kernel_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Generate Gaussian kernel. sigma <= 0 gives the identity kernel.
+static float* generate_gaussian_kernel(int radius, float sigma) {
     int size = 2 * radius + 1;
     float* kernel = (float*)malloc(size * sizeof(float));
-    float sigma = radius / 3.0f;
     float sum = 0.0f;
 
     for (int i = 0; i < size; i++) {
         float x = i - radius;
-        kernel[i] = expf(-(x * x) / (2.0f * sigma * sigma));
+        if (sigma > 0.0f) {
+            kernel[i] = expf(-(x * x) / (2.0f * sigma * sigma));
+        } else {
+            kernel[i] = (i == radius) ? 1.0f : 0.0f;
+        }
         sum += kernel[i];
     }
 
@@ -41,169 +102,812 @@ float* generate_gaussian_kernel(int radius) {
     return kernel;
 }
 
-// Horizontal blur pass
-void blur_horizontal(Image* src, Image* dst, float* kernel, int radius, int start_row, int end_row) {
-    int kernel_size = 2 * radius + 1;
+// Gaussian weights for (radius, sigma), computed once and then served from a
+// process-wide table. Once the table is full, new kernels are generated per
+// call. Either way hand the kernel back with gaussian_kernel_release.
+float* gaussian_kernel_acquire(int radius, float sigma) {
+    pthread_mutex_lock(&kernel_cache_lock);
+    for (int i = 0; i < kernel_cache_count; i++) {
+        if (kernel_cache[i].radius == radius && kernel_cache[i].sigma == sigma) {
+            float* weights = kernel_cache[i].weights;
+            pthread_mutex_unlock(&kernel_cache_lock);
+            return weights;
+        }
+    }
 
-    for (int y = start_row; y < end_row; y++) {
-        // Process left edge (x < radius)
-        for (int x = 0; x < radius && x < src->width; x++) {
-            // Always 4 channels now (RGBA)
-            for (int ch = 0; ch < 4; ch++) {
-                float sum = 0.0f;
+    float* weights = generate_gaussian_kernel(radius, sigma);
+    if (kernel_cache_count < KERNEL_CACHE_SIZE) {
+        CachedKernel entry = {radius, sigma, weights};
+        kernel_cache[kernel_cache_count++] = entry;
+    }
+    pthread_mutex_unlock(&kernel_cache_lock);
+    return weights;
+}
 
-                for (int k = 0; k < kernel_size; k++) {
-                    int src_x = x + k - radius;
-                    if (src_x < 0) src_x = 0;
+// Cached kernels stay in the table, only uncached ones are freed
+void gaussian_kernel_release(float* kernel) {
+    pthread_mutex_lock(&kernel_cache_lock);
+    int cached = 0;
+    for (int i = 0; i < kernel_cache_count && !cached; i++) {
+        cached = kernel_cache[i].weights == kernel;
+    }
+    pthread_mutex_unlock(&kernel_cache_lock);
+    if (!cached) free(kernel);
+}
 
-                    int idx = (y * src->width + src_x) * 4 + ch;
-                    sum += src->data[idx] * kernel[k];
-                }
+// Quantize a float kernel to Q14 into fixed (2 * radius + 1 taps). The
+// rounding error is folded into the center tap so the weights sum to exactly
+// 1.0 and flat areas stay flat.
+void quantize_kernel(const float* kernel, int radius, int16_t* fixed) {
+    int size = 2 * radius + 1;
+    int sum = 0;
 
-                int dst_idx = (y * dst->width + x) * 4 + ch;
-                dst->data[dst_idx] = (unsigned char)roundf(sum);
-            }
+    for (int i = 0; i < size; i++) {
+        fixed[i] = (int16_t)lroundf(kernel[i] * (1 << FIXED_SHIFT));
+        sum += fixed[i];
+    }
+    fixed[radius] += (1 << FIXED_SHIFT) - sum;
+}
+
+// One output pixel of the float horizontal pass, clamping taps at both row
+// ends. Sums taps in the same order as the interior loop and row_kernel, so
+// edge and interior pixels round the same way in every blur mode.
+static ALWAYS_INLINE void blur_pixel(const unsigned char* src_row, unsigned char* dst_row,
+                                     const float* kernel, int radius, int width, int x, int cn) {
+    for (int ch = 0; ch < cn; ch++) {
+        float sum = 0.0f;
+        UNROLL_TAPS
+        for (int k = 0; k < 2 * radius + 1; k++) {
+            int src_x = x + k - radius;
+            if (src_x < 0) src_x = 0;
+            if (src_x >= width) src_x = width - 1;
+            sum += src_row[(size_t)src_x * cn + ch] * kernel[k];
+        }
+        dst_row[(size_t)x * cn + ch] = (unsigned char)roundf(sum);
+    }
+}
+
+// Horizontal blur pass of cn-channel rows
+static ALWAYS_INLINE void blur_horizontal_n(Image* src, Image* dst, float* kernel, int start_row, int end_row,
+                                             BlurRowFn row_kernel, int cn, int radius) {
+    int kernel_size = 2 * radius + 1;
+
+    for (int y = start_row; y < end_row; y++) {
+        const unsigned char* src_row = image_row(src, y);
+        unsigned char* dst_row = image_row(dst, y);
+
+        // Left edge (x < radius). Taps are clamped at both ends, either
+        // can be hit when the row is no wider than 2 * radius.
+        for (int x = 0; x < radius && x < src->width; x++) {
+            blur_pixel(src_row, dst_row, kernel, radius, src->width, x, cn);
         }
 
         // Process middle part (no boundary checks needed)
-        for (int x = radius; x < src->width - radius; x++) {
-            // Always 4 channels now (RGBA)
-            for (int ch = 0; ch < 4; ch++) {
+        if (cn == 4 && row_kernel && radius < src->width - radius) {
+            row_kernel(src_row, dst_row, kernel, radius, radius, src->width - radius);
+        } else for (int x = radius; x < src->width - radius; x++) {
+            for (int ch = 0; ch < cn; ch++) {
                 float sum = 0.0f;
 
                 // No bounds checking needed here
+                UNROLL_TAPS
                 for (int k = 0; k < kernel_size; k++) {
                     int src_x = x + k - radius;
-                    int idx = (y * src->width + src_x) * 4 + ch;
-                    sum += src->data[idx] * kernel[k];
+                    sum += src_row[src_x * cn + ch] * kernel[k];
                 }
 
-                int dst_idx = (y * dst->width + x) * 4 + ch;
-                dst->data[dst_idx] = (unsigned char)roundf(sum);
+                dst_row[x * cn + ch] = (unsigned char)roundf(sum);
             }
         }
 
-        // Process right edge (x >= width - radius)
+        // Right edge (x >= width - radius)
         for (int x = src->width - radius; x < src->width; x++) {
             if (x < radius) continue;  // Skip if already processed in left edge
+            blur_pixel(src_row, dst_row, kernel, radius, src->width, x, cn);
+        }
+    }
+}
 
-            for (int ch = 0; ch < 4; ch++) {
-                float sum = 0.0f;
+// Horizontal blur pass. row_kernel vectorizes the interior of RGBA rows, other
+// channel counts use the scalar loop.
+void blur_horizontal(Image* src, Image* dst, float* kernel, int radius, int start_row, int end_row,
+                     BlurRowFn row_kernel) {
+    KERNEL_SWITCH(src->channels, radius, blur_horizontal_n, src, dst, kernel, start_row, end_row, row_kernel);
+}
 
-                for (int k = 0; k < kernel_size; k++) {
-                    int src_x = x + k - radius;
-                    if (src_x >= src->width) src_x = src->width - 1;
+// One output pixel of the fixed-point pass, with edge clamping
+static ALWAYS_INLINE void blur_pixel_fixed(const unsigned char* src_row, unsigned char* dst_row,
+                                           const int16_t* kernel, int radius, int width, int x, int cn) {
+    int32_t sum[4] = {0, 0, 0, 0};
+
+    UNROLL_TAPS
+    for (int k = 0; k < 2 * radius + 1; k++) {
+        int src_x = x + k - radius;
+        if (src_x < 0) src_x = 0;
+        if (src_x >= width) src_x = width - 1;
+
+        const unsigned char* pixel = src_row + (size_t)src_x * cn;
+        for (int ch = 0; ch < cn; ch++) {
+            sum[ch] += pixel[ch] * kernel[k];
+        }
+    }
+
+    for (int ch = 0; ch < cn; ch++) {
+        dst_row[(size_t)x * cn + ch] = (unsigned char)((sum[ch] + (1 << (FIXED_SHIFT - 1))) >> FIXED_SHIFT);
+    }
+}
+
+static ALWAYS_INLINE void blur_horizontal_fixed_n(Image* src, Image* dst, const int16_t* kernel,
+                                                   int start_row, int end_row, BlurRowFixedFn row_kernel,
+                                                   int cn, int radius) {
+    int w = src->width;
+    int x_begin = radius < w ? radius : w;
+    int x_end = (w - radius > x_begin) ? w - radius : x_begin;
+
+    for (int y = start_row; y < end_row; y++) {
+        const unsigned char* src_row = image_row(src, y);
+        unsigned char* dst_row = image_row(dst, y);
+
+        // Left edge
+        for (int x = 0; x < x_begin; x++) {
+            blur_pixel_fixed(src_row, dst_row, kernel, radius, w, x, cn);
+        }
+
+        // Middle part
+        if (cn == 4 && row_kernel && x_end > x_begin) {
+            row_kernel(src_row, dst_row, kernel, radius, x_begin, x_end);
+        } else {
+            for (int x = x_begin; x < x_end; x++) {
+                blur_pixel_fixed(src_row, dst_row, kernel, radius, w, x, cn);
+            }
+        }
+
+        // Right edge
+        for (int x = x_end; x < w; x++) {
+            blur_pixel_fixed(src_row, dst_row, kernel, radius, w, x, cn);
+        }
+    }
+}
+
+// Horizontal blur pass in fixed point: 8-bit pixels times Q14 weights summed
+// in 32-bit integers, no float conversion or roundf per output byte
+void blur_horizontal_fixed(Image* src, Image* dst, const int16_t* kernel, int radius,
+                           int start_row, int end_row, BlurRowFixedFn row_kernel) {
+    KERNEL_SWITCH(src->channels, radius, blur_horizontal_fixed_n, src, dst, kernel, start_row, end_row,
+                  row_kernel);
+}
+
+// Radii of BOX_PASSES box filters whose repeated application has the given
+// sigma: widths are the two odd integers around the ideal width, mixed so the
+// combined variance matches (Kovesi, "Fast almost-Gaussian filtering")
+void box_radii_for_sigma(float sigma, int* radii) {
+    int n = BOX_PASSES;
+    float ideal = sqrtf(12.0f * sigma * sigma / n + 1.0f);
+    int lower = (int)floorf(ideal);
+    if (lower % 2 == 0) lower--;
+    if (lower < 1) lower = 1;
+    int upper = lower + 2;
+
+    float m_ideal = (12.0f * sigma * sigma - n * lower * lower - 4.0f * n * lower - 3.0f * n) /
+                    (-4.0f * lower - 4.0f);
+    int m = (int)lroundf(m_ideal);
+
+    for (int i = 0; i < n; i++) {
+        radii[i] = ((i < m) ? lower : upper) / 2;
+    }
+}
+
+// Box blur of one row of cn-channel pixels with edge clamping. A running sum
+// per channel slides along the row, so each pixel costs one add and one
+// subtract whatever the radius. The divide by the box size is a Q32
+// reciprocal multiply in 64 bits: its error stays below half a level for any
+// box that fits in memory, so a flat row comes out unchanged at every radius.
+static ALWAYS_INLINE void box_blur_row(const unsigned char* src, unsigned char* dst, int width, int radius,
+                                       int cn) {
+    int size = 2 * radius + 1;
+    uint64_t inv = ((1ull << 32) + size / 2) / size;
+    uint32_t sum[4] = {0, 0, 0, 0};
+
+    for (int k = -radius; k <= radius; k++) {
+        int src_x = k < 0 ? 0 : (k >= width ? width - 1 : k);
+        for (int ch = 0; ch < cn; ch++) sum[ch] += src[src_x * cn + ch];
+    }
+
+    // Pixels whose window slides entirely inside the row
+    int x_begin = radius < width ? radius : width;
+    int x_end = (width - radius - 1 > x_begin) ? width - radius - 1 : x_begin;
 
-                    int idx = (y * src->width + src_x) * 4 + ch;
-                    sum += src->data[idx] * kernel[k];
+    for (int x = 0; x < width; x++) {
+        for (int ch = 0; ch < cn; ch++) {
+            uint64_t mean = (sum[ch] * inv + (1ull << 31)) >> 32;
+            dst[x * cn + ch] = (unsigned char)(mean < 255 ? mean : 255);
+        }
+
+        if (x >= x_begin && x < x_end) {
+            const unsigned char* add = src + (x + radius + 1) * cn;
+            const unsigned char* sub = src + (x - radius) * cn;
+            for (int ch = 0; ch < cn; ch++) sum[ch] += add[ch] - sub[ch];
+        } else {
+            int add_x = x + radius + 1;
+            int sub_x = x - radius;
+            if (add_x >= width) add_x = width - 1;
+            if (sub_x < 0) sub_x = 0;
+            for (int ch = 0; ch < cn; ch++) sum[ch] += src[add_x * cn + ch] - src[sub_x * cn + ch];
+        }
+    }
+}
+
+static ALWAYS_INLINE void blur_horizontal_box_n(Image* src, Image* dst, const int* radii,
+                                                 int start_row, int end_row, unsigned char* scratch, int cn) {
+    int w = src->width;
+
+    for (int y = start_row; y < end_row; y++) {
+        const unsigned char* in = image_row(src, y);
+        for (int pass = 0; pass < BOX_PASSES; pass++) {
+            unsigned char* out = (pass == BOX_PASSES - 1) ? image_row(dst, y)
+                                                          : scratch + (size_t)(pass % 2) * w * cn;
+            box_blur_row(in, out, w, radii[pass], cn);
+            in = out;
+        }
+    }
+}
+
+// All box passes of rows [start_row, end_row), ping-ponging through scratch
+// (two rows of src) so the intermediate passes never leave cache
+void blur_horizontal_box(Image* src, Image* dst, const int* radii, int start_row, int end_row,
+                         unsigned char* scratch) {
+    CHANNEL_SWITCH(src->channels, blur_horizontal_box_n, src, dst, radii, start_row, end_row, scratch);
+}
+
+// Vertical blur pass over columns [x_begin, x_end) of row-major data. Works
+// on strips of columns so the 2 * radius + 1 source rows feeding a strip stay
+// in cache as y advances. Channels are independent bytes here, so one loop
+// serves every channel count.
+static void blur_vertical_span(Image* src, Image* dst, float* kernel, int radius,
+                               int x_begin, int x_end, int start_row, int end_row) {
+    int kernel_size = 2 * radius + 1;
+    int h = src->height;
+    int cn = src->channels;
+    float acc[VERTICAL_STRIP * 4];
+
+    for (int x0 = x_begin; x0 < x_end; x0 += VERTICAL_STRIP) {
+        int n = ((x_end - x0 < VERTICAL_STRIP) ? x_end - x0 : VERTICAL_STRIP) * cn;
+
+        for (int y = start_row; y < end_row; y++) {
+            for (int i = 0; i < n; i++) acc[i] = 0.0f;
+
+            for (int k = 0; k < kernel_size; k++) {
+                int src_y = y + k - radius;
+                if (src_y < 0) src_y = 0;
+                if (src_y >= h) src_y = h - 1;
+
+                const unsigned char* row = image_row(src, src_y) + (size_t)x0 * cn;
+                float weight = kernel[k];
+                for (int i = 0; i < n; i++) {
+                    acc[i] += row[i] * weight;
                 }
+            }
+
+            unsigned char* out = image_row(dst, y) + (size_t)x0 * cn;
+            for (int i = 0; i < n; i++) {
+                out[i] = (unsigned char)roundf(acc[i]);
+            }
+        }
+    }
+}
+
+// Vertical blur pass over whole rows
+void blur_vertical(Image* src, Image* dst, float* kernel, int radius, int start_row, int end_row) {
+    blur_vertical_span(src, dst, kernel, radius, 0, src->width, start_row, end_row);
+}
+
+// Horizontal blur pass over columns [x_begin, x_end) only, split into the
+// same clamped edges and row_kernel interior as blur_horizontal
+static ALWAYS_INLINE void blur_horizontal_span_n(Image* src, Image* dst, float* kernel,
+                                                  int x_begin, int x_end, int start_row, int end_row,
+                                                  BlurRowFn row_kernel, int cn, int radius) {
+    int w = src->width;
+    int inner_begin = x_begin > radius ? x_begin : radius;
+    int inner_end = x_end < w - radius ? x_end : w - radius;
+
+    for (int y = start_row; y < end_row; y++) {
+        const unsigned char* src_row = image_row(src, y);
+        unsigned char* dst_row = image_row(dst, y);
 
-                int dst_idx = (y * dst->width + x) * dst->channels + ch;
-                dst->data[dst_idx] = (unsigned char)roundf(sum);
+        if (inner_begin >= inner_end) {
+            for (int x = x_begin; x < x_end; x++) {
+                blur_pixel(src_row, dst_row, kernel, radius, w, x, cn);
+            }
+            continue;
+        }
+        for (int x = x_begin; x < inner_begin; x++) {
+            blur_pixel(src_row, dst_row, kernel, radius, w, x, cn);
+        }
+        if (cn == 4 && row_kernel) {
+            row_kernel(src_row, dst_row, kernel, radius, inner_begin, inner_end);
+        } else {
+            for (int x = inner_begin; x < inner_end; x++) {
+                blur_pixel(src_row, dst_row, kernel, radius, w, x, cn);
             }
         }
+        for (int x = inner_end; x < x_end; x++) {
+            blur_pixel(src_row, dst_row, kernel, radius, w, x, cn);
+        }
     }
 }
 
-// Transpose image for cache-friendly vertical blur
-void transpose_image(Image* src, Image* dst) {
-    for (int y = 0; y < src->height; y++) {
-        for (int x = 0; x < src->width; x++) {
-            for (int ch = 0; ch < 4; ch++) {
-                int src_idx = (y * src->width + x) * 4 + ch;
-                int dst_idx = (x * src->height + y) * 4 + ch;
-                dst->data[dst_idx] = src->data[src_idx];
+static void blur_horizontal_span(Image* src, Image* dst, float* kernel, int radius,
+                                 int x_begin, int x_end, int start_row, int end_row,
+                                 BlurRowFn row_kernel) {
+    KERNEL_SWITCH(src->channels, radius, blur_horizontal_span_n, src, dst, kernel, x_begin, x_end,
+                  start_row, end_row, row_kernel);
+}
+
+static ALWAYS_INLINE void transpose_image_n(Image* src, Image* dst, int start_row, int end_row, int cn) {
+    int w = src->width;
+    size_t dst_stride = image_stride(dst);
+
+    for (int by = start_row; by < end_row; by += TRANSPOSE_BLOCK) {
+        int y_end = (by + TRANSPOSE_BLOCK < end_row) ? by + TRANSPOSE_BLOCK : end_row;
+
+        for (int bx = 0; bx < w; bx += TRANSPOSE_BLOCK) {
+            int x_end = (bx + TRANSPOSE_BLOCK < w) ? bx + TRANSPOSE_BLOCK : w;
+
+            for (int y = by; y < y_end; y++) {
+                const unsigned char* src_row = image_row(src, y);
+                unsigned char* dst_col = dst->data + (size_t)y * cn;
+                for (int x = bx; x < x_end; x++) {
+                    memcpy(dst_col + (size_t)x * dst_stride, src_row + (size_t)x * cn, cn);
+                }
             }
         }
     }
 }
 
-// Worker thread function
-void* worker_thread(void* arg) {
+// Transpose rows [start_row, end_row) of src into columns of dst. Works on
+// square blocks so both the reads and the strided writes stay in cache. With
+// cn constant, each pixel moves as a single load and store (one 32-bit word
+// for RGBA).
+void transpose_image(Image* src, Image* dst, int start_row, int end_row) {
+    CHANNEL_SWITCH(src->channels, transpose_image_n, src, dst, start_row, end_row);
+}
+
+// Pool loop body for one tile of a horizontal blur pass
+void blur_worker(void* arg, int start_row, int end_row, int worker) {
+    (void)worker;
     WorkerContext* ctx = (WorkerContext*)arg;
-    blur_horizontal(ctx->src, ctx->dst, ctx->kernel, ctx->radius, ctx->start_row, ctx->end_row);
-    return NULL;
+    if (ctx->kernel_fixed) {
+        blur_horizontal_fixed(ctx->src, ctx->dst, ctx->kernel_fixed, ctx->radius, start_row, end_row,
+                              ctx->row_kernel_fixed);
+    } else {
+        blur_horizontal(ctx->src, ctx->dst, ctx->kernel, ctx->radius, start_row, end_row, ctx->row_kernel);
+    }
 }
 
-// Apply Gaussian blur with multiple threads
-void gaussian_blur(Image* src, Image* dst, int radius, int num_workers) {
-    float* kernel = generate_gaussian_kernel(radius);
+// Pool loop body for one tile of the box passes
+void box_blur_worker(void* arg, int start_row, int end_row, int worker) {
+    WorkerContext* ctx = (WorkerContext*)arg;
+    blur_horizontal_box(ctx->src, ctx->dst, ctx->box_radius, start_row, end_row,
+                        ctx->worker_scratch + (size_t)worker * ctx->worker_scratch_bytes);
+}
 
-    // Allocate temporary buffers
-    Image temp1 = {
-        .data = (unsigned char*)malloc(src->width * src->height * 4),
-        .width = src->width,
-        .height = src->height,
-        .channels = 4
-    };
+// Pool loop body for one tile of a transpose. The loop runs over
+// TRANSPOSE_BLOCK-row blocks rather than rows, so every tile is a whole
+// number of blocks however small the pool's default grain gets.
+void transpose_worker(void* arg, int start_block, int end_block, int worker) {
+    (void)worker;
+    WorkerContext* ctx = (WorkerContext*)arg;
+    int end_row = end_block * TRANSPOSE_BLOCK;
+    if (end_row > ctx->src->height) end_row = ctx->src->height;
+    transpose_image(ctx->src, ctx->dst, start_block * TRANSPOSE_BLOCK, end_row);
+}
+
+// Transpose src into dst on the pool, one tile per run of row blocks
+static void transpose_on_pool(WorkerContext* ctx, Image* src, Image* dst, ThreadPool* pool) {
+    ctx->src = src;
+    ctx->dst = dst;
+    thread_pool_for(pool, (src->height + TRANSPOSE_BLOCK - 1) / TRANSPOSE_BLOCK, transpose_worker, ctx);
+}
 
+// Pool loop body for one tile of a direct vertical pass
+void blur_vertical_worker(void* arg, int start_row, int end_row, int worker) {
+    (void)worker;
+    WorkerContext* ctx = (WorkerContext*)arg;
+    blur_vertical(ctx->src, ctx->dst, ctx->kernel, ctx->radius, start_row, end_row);
+}
+
+// Vertical pass via transpose, horizontal blur and transpose back
+static void blur_vertical_transposed(WorkerContext* ctx, Image* src, Image* dst, ThreadPool* pool,
+                                     PoolRangeFn horizontal) {
+    size_t frame_bytes = (size_t)src->width * src->height * src->channels;
     Image temp2 = {
-        .data = (unsigned char*)malloc(src->width * src->height * 4),
+        .data = (unsigned char*)thread_pool_buffer(pool, BLUR_SLOT_TRANSPOSED, frame_bytes),
         .width = src->height,  // Swapped for transpose
         .height = src->width,
-        .channels = 4
+        .channels = src->channels
     };
 
-    // Create worker contexts and threads
-    pthread_t* threads = (pthread_t*)malloc(num_workers * sizeof(pthread_t));
-    WorkerContext* contexts = (WorkerContext*)malloc(num_workers * sizeof(WorkerContext));
+    Image temp3 = {
+        .data = (unsigned char*)thread_pool_buffer(pool, BLUR_SLOT_TRANSPOSED_BLURRED, frame_bytes),
+        .width = src->height,  // Still transposed
+        .height = src->width,
+        .channels = src->channels
+    };
 
-    // Phase 1: Horizontal blur
-    int rows_per_worker = src->height / num_workers;
-    for (int i = 0; i < num_workers; i++) {
-        contexts[i].src = src;
-        contexts[i].dst = &temp1;
-        contexts[i].kernel = kernel;
-        contexts[i].radius = radius;
-        contexts[i].start_row = i * rows_per_worker;
-        contexts[i].end_row = (i == num_workers - 1) ? src->height : (i + 1) * rows_per_worker;
+    // Transpose for vertical pass
+    thread_pool_set_phase(pool, "transpose");
+    transpose_on_pool(ctx, src, &temp2, pool);
+
+    // Vertical blur (horizontal on transposed)
+    ctx->src = &temp2;
+    ctx->dst = &temp3;
+    thread_pool_set_phase(pool, "vertical");
+    thread_pool_for(pool, temp2.height, horizontal, ctx);
+
+    // Transpose back to original orientation
+    thread_pool_set_phase(pool, "transpose_back");
+    transpose_on_pool(ctx, &temp3, dst, pool);
+}
+
+// Blur rows [start_row, end_row) of src into the same rows of dst on the
+// calling thread, with the fused strategy. Only the rows feeding the output
+// get a horizontal pass. scratch must be the size of src. Used by pipeline.c
+// to blur one band of a larger image.
+void gaussian_blur_rows(Image* src, Image* dst, Image* scratch, float* kernel, int radius,
+                        int start_row, int end_row) {
+    int first = (start_row - radius > 0) ? start_row - radius : 0;
+    int last = (end_row + radius < src->height) ? end_row + radius : src->height;
+
+    blur_horizontal(src, scratch, kernel, radius, first, last, blur_select_row_kernel());
+    blur_vertical(scratch, dst, kernel, radius, start_row, end_row);
+}
+
+// Pool loop body for BLUR_TILED over bands [begin, end) of tile_rows rows. A
+// band's horizontal pass, with its vertical halo, goes to this worker's slice
+// of the scratch buffer and the vertical pass reads it back from cache, so
+// dst is written once and no full-frame temporary exists. Consecutive bands
+// share 2 * radius halo rows, which are moved to the top of the scratch
+// buffer rather than blurred again.
+void blur_tiled_worker(void* arg, int begin, int end, int worker) {
+    WorkerContext* ctx = (WorkerContext*)arg;
+    Image* src = ctx->src;
+    int w = src->width;
+    int h = src->height;
+    int radius = ctx->radius;
+    size_t row_bytes = (size_t)w * src->channels;
+
+    Image scratch = {
+        .data = ctx->worker_scratch + (size_t)worker * ctx->worker_scratch_bytes,
+        .width = w,
+        .channels = src->channels
+    };
+    // Image rows whose horizontal pass is in scratch, starting at its row 0
+    int have_first = 0;
+    int have_last = 0;
+
+    for (int b = begin; b < end; b++) {
+        int y0 = b * ctx->tile_rows;
+        int y1 = (y0 + ctx->tile_rows < h) ? y0 + ctx->tile_rows : h;
+        int first = (y0 - radius > 0) ? y0 - radius : 0;
+        int last = (y1 + radius < h) ? y1 + radius : h;
+
+        int kept = 0;
+        if (first >= have_first && first < have_last) {
+            kept = have_last - first;
+            memmove(scratch.data, scratch.data + (size_t)(first - have_first) * row_bytes, kept * row_bytes);
+        }
+
+        // Views of the band and its halo. Their top and bottom only clamp
+        // where they touch the real image edge, as in pipeline.c.
+        ImageRect band = {0, first, w, last - first};
+        Image in = image_view(src, band);
+        Image out = image_view(ctx->dst, band);
+        scratch.height = band.height;
+        blur_horizontal(&in, &scratch, ctx->kernel, radius, kept, band.height, ctx->row_kernel);
+        blur_vertical(&scratch, &out, ctx->kernel, radius, y0 - first, y1 - first);
+
+        have_first = first;
+        have_last = last;
+    }
+}
+
+// BLUR_TILED: bands of rows sized to TILE_BYTES, each blurred in both
+// directions before the next one starts. The pool schedules whole bands, so
+// only the first band of each scheduler tile computes its upper halo.
+static void blur_tiled(Image* src, Image* dst, float* kernel, int radius, ThreadPool* pool) {
+    size_t row_bytes = (size_t)src->width * src->channels;
+    int tile_rows = (int)(TILE_BYTES / row_bytes) - 2 * radius;
+    if (tile_rows < TILE_MIN_ROWS) tile_rows = TILE_MIN_ROWS;
+
+    int band_rows = tile_rows + 2 * radius < src->height ? tile_rows + 2 * radius : src->height;
+    size_t band_bytes = (row_bytes * band_rows + 63) / 64 * 64;
+    int workers = thread_pool_size(pool);
+
+    WorkerContext ctx = {
+        .src = src,
+        .dst = dst,
+        .kernel = kernel,
+        .radius = radius,
+        .row_kernel = blur_select_row_kernel(),
+        .worker_scratch = (unsigned char*)thread_pool_buffer(pool, BLUR_SLOT_WORKERS, band_bytes * workers),
+        .worker_scratch_bytes = band_bytes,
+        .tile_rows = tile_rows
+    };
+    thread_pool_set_phase(pool, "tiled");
+    thread_pool_for(pool, (src->height + tile_rows - 1) / tile_rows, blur_tiled_worker, &ctx);
+}
+
+// Shared state of a BLUR_GRAPH run. Strip i covers rows [i * strip_rows,
+// (i + 1) * strip_rows) in both passes. Its vertical pass reads the
+// horizontal output of every strip within radius rows, and pending[i] counts
+// those down; the horizontal strip that brings it to zero publishes i.
+typedef struct {
+    Image* src;
+    Image* temp;  // Horizontal pass output
+    Image* dst;
+    float* kernel;
+    int radius;
+    BlurRowFn row_kernel;
+    int strip_rows;
+    int num_strips;
+
+    _Atomic int next_horizontal;  // Next horizontal strip to claim
+    _Atomic int* pending;         // Per strip, horizontal strips its vertical pass still needs
+    _Atomic int* ready;           // Strips with a runnable vertical pass, -1 until published
+    _Atomic int ready_head;       // Next ready slot to claim
+    _Atomic int ready_tail;       // Next ready slot to publish into
+} BlurGraph;
+
+// Horizontal strips [first, last] under the vertical pass of strip i
+static void graph_inputs(const BlurGraph* graph, int i, int* first, int* last) {
+    int h = graph->src->height;
+    int top = i * graph->strip_rows - graph->radius;
+    int bottom = (i + 1) * graph->strip_rows + graph->radius;
+    if (top < 0) top = 0;
+    if (bottom > h) bottom = h;
+    *first = top / graph->strip_rows;
+    *last = (bottom - 1) / graph->strip_rows;
+}
 
-        pthread_create(&threads[i], NULL, worker_thread, &contexts[i]);
+// Take the oldest ready vertical strip, -1 if none is ready right now
+static int graph_claim_ready(BlurGraph* graph) {
+    int head = atomic_load(&graph->ready_head);
+    while (head < atomic_load(&graph->ready_tail)) {
+        if (atomic_compare_exchange_weak(&graph->ready_head, &head, head + 1)) {
+            // The slot was reserved before it was written, wait for the strip
+            int strip;
+            while ((strip = atomic_load_explicit(&graph->ready[head], memory_order_acquire)) < 0) {
+                sched_yield();
+            }
+            return strip;
+        }
     }
+    return -1;
+}
 
-    // Wait for all threads to complete
-    for (int i = 0; i < num_workers; i++) {
-        pthread_join(threads[i], NULL);
+// Horizontal strip j is done: count it off for every vertical strip it feeds
+static void graph_finish_horizontal(BlurGraph* graph, int j) {
+    int reach = graph->radius / graph->strip_rows + 1;
+    int lo = j - reach > 0 ? j - reach : 0;
+    int hi = j + reach < graph->num_strips - 1 ? j + reach : graph->num_strips - 1;
+
+    for (int i = lo; i <= hi; i++) {
+        int first, last;
+        graph_inputs(graph, i, &first, &last);
+        if (j < first || j > last) continue;
+        if (atomic_fetch_sub_explicit(&graph->pending[i], 1, memory_order_acq_rel) == 1) {
+            int slot = atomic_fetch_add(&graph->ready_tail, 1);
+            atomic_store_explicit(&graph->ready[slot], i, memory_order_release);
+        }
     }
+}
 
-    // Transpose for vertical pass
-    transpose_image(&temp1, &temp2);
+// Pool task of BLUR_GRAPH. Every worker runs ready vertical strips first and
+// otherwise claims the next horizontal strip, so there is no barrier between
+// the passes. Ready work only runs out near the end, while the last
+// horizontal strips a vertical strip needs are still being blurred.
+void blur_graph_worker(void* arg, int worker) {
+    (void)worker;
+    BlurGraph* graph = (BlurGraph*)arg;
+    int h = graph->src->height;
+
+    for (;;) {
+        int v = graph_claim_ready(graph);
+        if (v >= 0) {
+            int y0 = v * graph->strip_rows;
+            int y1 = y0 + graph->strip_rows < h ? y0 + graph->strip_rows : h;
+            blur_vertical(graph->temp, graph->dst, graph->kernel, graph->radius, y0, y1);
+            continue;
+        }
+        if (atomic_load(&graph->ready_head) >= graph->num_strips) break;
+
+        int j = atomic_fetch_add(&graph->next_horizontal, 1);
+        if (j < graph->num_strips) {
+            int y0 = j * graph->strip_rows;
+            int y1 = y0 + graph->strip_rows < h ? y0 + graph->strip_rows : h;
+            blur_horizontal(graph->src, graph->temp, graph->kernel, graph->radius, y0, y1,
+                            graph->row_kernel);
+            graph_finish_horizontal(graph, j);
+            continue;
+        }
 
-    // Create temp3 for the second blur pass result
-    Image temp3 = {
-        .data = (unsigned char*)malloc(src->width * src->height * 4),
-        .width = src->height,  // Still transposed
-        .height = src->width,
-        .channels = 4
+        // Every horizontal strip is taken; wait for the ones still running
+        sched_yield();
+    }
+}
+
+// BLUR_GRAPH: BLUR_FUSED's two passes as one task graph over row strips
+static void blur_graph(Image* src, Image* temp, Image* dst, float* kernel, int radius, ThreadPool* pool) {
+    int strip_rows = src->height / (thread_pool_size(pool) * GRAPH_STRIPS_PER_WORKER);
+    if (strip_rows < GRAPH_MIN_STRIP_ROWS) strip_rows = GRAPH_MIN_STRIP_ROWS;
+    int num_strips = (src->height + strip_rows - 1) / strip_rows;
+    _Atomic int* counters = (_Atomic int*)thread_pool_buffer(pool, BLUR_SLOT_GRAPH,
+                                                            2 * (size_t)num_strips * sizeof(_Atomic int));
+
+    BlurGraph graph = {
+        .src = src,
+        .temp = temp,
+        .dst = dst,
+        .kernel = kernel,
+        .radius = radius,
+        .row_kernel = blur_select_row_kernel(),
+        .strip_rows = strip_rows,
+        .num_strips = num_strips,
+        .pending = counters,
+        .ready = counters + num_strips
     };
+    atomic_init(&graph.next_horizontal, 0);
+    atomic_init(&graph.ready_head, 0);
+    atomic_init(&graph.ready_tail, 0);
+    for (int i = 0; i < num_strips; i++) {
+        int first, last;
+        graph_inputs(&graph, i, &first, &last);
+        atomic_init(&graph.pending[i], last - first + 1);
+        atomic_init(&graph.ready[i], -1);
+    }
 
-    // Phase 2: Vertical blur (horizontal on transposed)
-    rows_per_worker = src->width / num_workers;
-    for (int i = 0; i < num_workers; i++) {
-        contexts[i].src = &temp2;
-        contexts[i].dst = &temp3;
-        contexts[i].kernel = kernel;
-        contexts[i].radius = radius;
-        contexts[i].start_row = i * rows_per_worker;
-        contexts[i].end_row = (i == num_workers - 1) ? src->width : (i + 1) * rows_per_worker;
+    thread_pool_set_phase(pool, "graph");
+    thread_pool_run(pool, blur_graph_worker, &graph);
+}
 
-        pthread_create(&threads[i], NULL, worker_thread, &contexts[i]);
+// Apply Gaussian blur on the worker pool
+void gaussian_blur_sigma(Image* src, Image* dst, int radius, float sigma, BlurMode mode, ThreadPool* pool) {
+    float* kernel = gaussian_kernel_acquire(radius, sigma);
+    if (mode == BLUR_TILED) {
+        blur_tiled(src, dst, kernel, radius, pool);
+        gaussian_kernel_release(kernel);
+        return;
     }
 
-    // Wait for all threads to complete
-    for (int i = 0; i < num_workers; i++) {
-        pthread_join(threads[i], NULL);
+    // Output of the horizontal pass. Temporaries come from the pool's scratch
+    // arena, so repeated blurs of same-sized images reuse the same memory.
+    Image temp1 = {
+        .data = (unsigned char*)thread_pool_buffer(pool, BLUR_SLOT_HORIZONTAL,
+                                                   (size_t)src->width * src->height * src->channels),
+        .width = src->width,
+        .height = src->height,
+        .channels = src->channels
+    };
+
+    WorkerContext ctx = {
+        .kernel = kernel,
+        .radius = radius,
+        .row_kernel = blur_select_row_kernel()
+    };
+
+    if (mode == BLUR_FIXED) {
+        ctx.kernel_fixed = (int16_t*)thread_pool_buffer(pool, BLUR_SLOT_FIXED_KERNEL,
+                                                        (2 * radius + 1) * sizeof(int16_t));
+        quantize_kernel(kernel, radius, ctx.kernel_fixed);
+        ctx.row_kernel_fixed = blur_select_row_kernel_fixed();
     }
 
-    // Transpose back to original orientation
-    transpose_image(&temp3, dst);
+    if (mode == BLUR_GRAPH) {
+        blur_graph(src, &temp1, dst, kernel, radius, pool);
+        gaussian_kernel_release(kernel);
+        return;
+    }
+
+    PoolRangeFn horizontal = blur_worker;
+    if (mode == BLUR_BOX) {
+        box_radii_for_sigma(sigma, ctx.box_radius);
+        horizontal = box_blur_worker;
+
+        // Two rows per worker, as long as the rows of either pass direction
+        int longest = src->width > src->height ? src->width : src->height;
+        ctx.worker_scratch_bytes = ((size_t)longest * src->channels * 2 + 63) / 64 * 64;
+        ctx.worker_scratch = (unsigned char*)thread_pool_buffer(pool, BLUR_SLOT_WORKERS,
+                                                                ctx.worker_scratch_bytes * thread_pool_size(pool));
+    }
+
+    // Phase 1: Horizontal blur
+    ctx.src = src;
+    ctx.dst = &temp1;
+    thread_pool_set_phase(pool, "horizontal");
+    thread_pool_for(pool, src->height, horizontal, &ctx);
+
+    // Phase 2: Vertical blur
+    if (mode == BLUR_FUSED) {
+        ctx.src = &temp1;
+        ctx.dst = dst;
+        thread_pool_set_phase(pool, "vertical");
+        thread_pool_for(pool, src->height, blur_vertical_worker, &ctx);
+    } else {
+        blur_vertical_transposed(&ctx, &temp1, dst, pool, horizontal);
+    }
 
     // Clean up
-    free(temp1.data);
-    free(temp2.data);
-    free(temp3.data);
-    free(kernel);
-    free(threads);
-    free(contexts);
+    gaussian_kernel_release(kernel);
+}
+
+void gaussian_blur(Image* src, Image* dst, int radius, BlurMode mode, ThreadPool* pool) {
+    gaussian_blur_sigma(src, dst, radius, gaussian_default_sigma(radius), mode, pool);
+}
+
+// Pool loop body for the horizontal pass of gaussian_blur_region
+void blur_region_horizontal_worker(void* arg, int start_row, int end_row, int worker) {
+    (void)worker;
+    WorkerContext* ctx = (WorkerContext*)arg;
+    ImageRect* rect = &ctx->rect;
+    blur_horizontal_span(ctx->src, ctx->dst, ctx->kernel, ctx->radius, rect->x, rect->x + rect->width,
+                         rect->y + start_row, rect->y + end_row, ctx->row_kernel);
 }
 
+// Pool loop body for the vertical pass of gaussian_blur_region
+void blur_region_vertical_worker(void* arg, int start_row, int end_row, int worker) {
+    (void)worker;
+    WorkerContext* ctx = (WorkerContext*)arg;
+    ImageRect* rect = &ctx->rect;
+    blur_vertical_span(ctx->src, ctx->dst, ctx->kernel, ctx->radius, rect->x, rect->x + rect->width,
+                       rect->y + start_row, rect->y + end_row);
+}
+
+// Incremental re-blur after src changed inside dirty: only the pixels within
+// radius of dirty are recomputed into dst, the rest of dst is left as it is.
+// The horizontal pass runs over those columns for the window's rows plus the
+// vertical halo, so the cost follows the size of the edit. Output matches
+// BLUR_TRANSPOSE and BLUR_FUSED with the same radius and sigma exactly. The
+// horizontal temporary stays in the pool's arena, so repeated edits of one
+// frame allocate nothing. Returns the window that was written, empty when
+// dirty misses the image.
+ImageRect gaussian_blur_region(Image* src, Image* dst, int radius, float sigma, ImageRect dirty,
+                               ThreadPool* pool) {
+    ImageRect empty = {0, 0, 0, 0};
+    if (dirty.width <= 0 || dirty.height <= 0) return empty;
+    ImageRect out = clip_rect(dirty, radius, src->width, src->height);
+    if (out.width == 0 || out.height == 0) return out;
+
+    float* kernel = gaussian_kernel_acquire(radius, sigma);
+    Image temp = {
+        .data = (unsigned char*)thread_pool_buffer(pool, BLUR_SLOT_HORIZONTAL,
+                                                   (size_t)src->width * src->height * src->channels),
+        .width = src->width,
+        .height = src->height,
+        .channels = src->channels
+    };
+
+    // Rows of the horizontal pass: the window plus the vertical pass's halo
+    ImageRect rows = clip_rect(out, radius, src->width, src->height);
+    rows.x = out.x;
+    rows.width = out.width;
+
+    WorkerContext ctx = {
+        .src = src,
+        .dst = &temp,
+        .kernel = kernel,
+        .radius = radius,
+        .row_kernel = blur_select_row_kernel(),
+        .rect = rows
+    };
+    thread_pool_set_phase(pool, "horizontal");
+    thread_pool_for(pool, rows.height, blur_region_horizontal_worker, &ctx);
+
+    ctx.src = &temp;
+    ctx.dst = dst;
+    ctx.rect = out;
+    thread_pool_set_phase(pool, "vertical");
+    thread_pool_for(pool, out.height, blur_region_vertical_worker, &ctx);
+
+    gaussian_kernel_release(kernel);
+    return out;
+}
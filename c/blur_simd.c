@@ -0,0 +1,339 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "filter_internal.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BLUR_SIMD_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define BLUR_SIMD_NEON 1
+#endif
+
+#if defined(BLUR_SIMD_X86) && !defined(BLUR_NO_SIMD)
+
+// roundf() for non-negative lanes: truncate, then bump when the fraction is >= 0.5
+__attribute__((target("sse4.1")))
+static inline __m128 round_half_up_ps(__m128 v) {
+    __m128 t = _mm_round_ps(v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+    __m128 up = _mm_cmpge_ps(_mm_sub_ps(v, t), _mm_set1_ps(0.5f));
+    return _mm_add_ps(t, _mm_and_ps(up, _mm_set1_ps(1.0f)));
+}
+
+__attribute__((target("avx2")))
+static inline __m256 round_half_up_ps256(__m256 v) {
+    __m256 t = _mm256_round_ps(v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+    __m256 up = _mm256_cmp_ps(_mm256_sub_ps(v, t), _mm256_set1_ps(0.5f), _CMP_GE_OQ);
+    return _mm256_add_ps(t, _mm256_and_ps(up, _mm256_set1_ps(1.0f)));
+}
+
+// One RGBA pixel as a float4
+__attribute__((target("sse4.1")))
+static inline __m128 load_pixel_ps(const unsigned char* p) {
+    int bits;
+    __builtin_memcpy(&bits, p, 4);
+    return _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(bits)));
+}
+
+__attribute__((target("sse4.1")))
+static inline void store_pixel_ps(unsigned char* p, __m128 v) {
+    __m128i i32 = _mm_cvtps_epi32(round_half_up_ps(v));
+    __m128i u8 = _mm_packus_epi16(_mm_packus_epi32(i32, i32), _mm_setzero_si128());
+    int bits = _mm_cvtsi128_si32(u8);
+    __builtin_memcpy(p, &bits, 4);
+}
+
+// SSE4.1: one pixel per iteration, the 4 channels in one float4
+__attribute__((target("sse4.1")))
+static ALWAYS_INLINE void blur_row_sse41_r(const unsigned char* src, unsigned char* dst,
+                                           const float* kernel, int x_begin, int x_end, int radius) {
+    int kernel_size = 2 * radius + 1;
+
+    for (int x = x_begin; x < x_end; x++) {
+        const unsigned char* taps = src + (size_t)(x - radius) * 4;
+        __m128 sum = _mm_setzero_ps();
+        UNROLL_TAPS
+        for (int k = 0; k < kernel_size; k++) {
+            __m128 weight = _mm_set1_ps(kernel[k]);
+            sum = _mm_add_ps(sum, _mm_mul_ps(load_pixel_ps(taps + k * 4), weight));
+        }
+        store_pixel_ps(dst + (size_t)x * 4, sum);
+    }
+}
+
+__attribute__((target("sse4.1")))
+static void blur_row_sse41(const unsigned char* src, unsigned char* dst,
+                           const float* kernel, int radius, int x_begin, int x_end) {
+    RADIUS_SWITCH(radius, blur_row_sse41_r, src, dst, kernel, x_begin, x_end);
+}
+
+// Two adjacent RGBA pixels as a float8
+__attribute__((target("avx2")))
+static inline __m256 load_pixel2_ps(const unsigned char* p) {
+    return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)p)));
+}
+
+// AVX2 + FMA: four pixels per iteration in two float8 accumulators
+__attribute__((target("avx2,fma")))
+static ALWAYS_INLINE void blur_row_avx2_r(const unsigned char* src, unsigned char* dst,
+                                          const float* kernel, int x_begin, int x_end, int radius) {
+    int kernel_size = 2 * radius + 1;
+    int x = x_begin;
+
+    for (; x + 4 <= x_end; x += 4) {
+        const unsigned char* taps = src + (size_t)(x - radius) * 4;
+        __m256 sum_lo = _mm256_setzero_ps();
+        __m256 sum_hi = _mm256_setzero_ps();
+        UNROLL_TAPS
+        for (int k = 0; k < kernel_size; k++) {
+            __m256 weight = _mm256_set1_ps(kernel[k]);
+            sum_lo = _mm256_fmadd_ps(load_pixel2_ps(taps + k * 4), weight, sum_lo);
+            sum_hi = _mm256_fmadd_ps(load_pixel2_ps(taps + k * 4 + 8), weight, sum_hi);
+        }
+
+        __m256i lo = _mm256_cvtps_epi32(round_half_up_ps256(sum_lo));
+        __m256i hi = _mm256_cvtps_epi32(round_half_up_ps256(sum_hi));
+        __m128i u16_lo = _mm_packus_epi32(_mm256_castsi256_si128(lo), _mm256_extracti128_si256(lo, 1));
+        __m128i u16_hi = _mm_packus_epi32(_mm256_castsi256_si128(hi), _mm256_extracti128_si256(hi, 1));
+        _mm_storeu_si128((__m128i*)(dst + (size_t)x * 4), _mm_packus_epi16(u16_lo, u16_hi));
+    }
+
+    for (; x < x_end; x++) {
+        const unsigned char* taps = src + (size_t)(x - radius) * 4;
+        __m128 sum = _mm_setzero_ps();
+        UNROLL_TAPS
+        for (int k = 0; k < kernel_size; k++) {
+            sum = _mm_fmadd_ps(load_pixel_ps(taps + k * 4), _mm_set1_ps(kernel[k]), sum);
+        }
+        store_pixel_ps(dst + (size_t)x * 4, sum);
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void blur_row_avx2(const unsigned char* src, unsigned char* dst,
+                          const float* kernel, int radius, int x_begin, int x_end) {
+    RADIUS_SWITCH(radius, blur_row_avx2_r, src, dst, kernel, x_begin, x_end);
+}
+
+
+// Q14 weight pair (kernel[k], kernel[k + 1]) in every 32-bit lane, for pmaddwd
+static inline int weight_pair(const int16_t* kernel, int k, int kernel_size) {
+    uint16_t lo = (uint16_t)kernel[k];
+    uint16_t hi = (k + 1 < kernel_size) ? (uint16_t)kernel[k + 1] : 0;
+    return (int)(((uint32_t)hi << 16) | lo);
+}
+
+// Fixed point, SSE4.1: two taps per pmaddwd. Interleaving tap k and tap k + 1
+// as 16-bit lanes gives eight products per instruction, twice the float4 rate.
+// Results go back through packus so lanes are clamped to [0, 255] for free.
+__attribute__((target("sse4.1")))
+static ALWAYS_INLINE void blur_row_fixed_sse41_r(const unsigned char* src, unsigned char* dst,
+                                                 const int16_t* kernel, int x_begin, int x_end, int radius) {
+    int kernel_size = 2 * radius + 1;
+    const __m128i half = _mm_set1_epi32(1 << (FIXED_SHIFT - 1));
+    int x = x_begin;
+
+    // Two pixels per iteration
+    for (; x + 2 <= x_end; x += 2) {
+        const unsigned char* taps = src + (size_t)(x - radius) * 4;
+        __m128i sum0 = _mm_setzero_si128();
+        __m128i sum1 = _mm_setzero_si128();
+        UNROLL_TAPS
+        for (int k = 0; k < kernel_size; k += 2) {
+            __m128i weights = _mm_set1_epi32(weight_pair(kernel, k, kernel_size));
+            __m128i a = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(taps + k * 4)));
+            __m128i b = (k + 1 < kernel_size)
+                ? _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(taps + k * 4 + 4)))
+                : _mm_setzero_si128();
+            sum0 = _mm_add_epi32(sum0, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), weights));
+            sum1 = _mm_add_epi32(sum1, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), weights));
+        }
+        sum0 = _mm_srli_epi32(_mm_add_epi32(sum0, half), FIXED_SHIFT);
+        sum1 = _mm_srli_epi32(_mm_add_epi32(sum1, half), FIXED_SHIFT);
+        __m128i u16 = _mm_packus_epi32(sum0, sum1);
+        _mm_storel_epi64((__m128i*)(dst + (size_t)x * 4), _mm_packus_epi16(u16, u16));
+    }
+
+    // Last pixel when the interior has odd width
+    for (; x < x_end; x++) {
+        const unsigned char* taps = src + (size_t)(x - radius) * 4;
+        __m128i sum = _mm_setzero_si128();
+        UNROLL_TAPS
+        for (int k = 0; k < kernel_size; k += 2) {
+            int bits_a, bits_b = 0;
+            __builtin_memcpy(&bits_a, taps + k * 4, 4);
+            if (k + 1 < kernel_size) __builtin_memcpy(&bits_b, taps + k * 4 + 4, 4);
+            __m128i a = _mm_cvtepu8_epi16(_mm_cvtsi32_si128(bits_a));
+            __m128i b = _mm_cvtepu8_epi16(_mm_cvtsi32_si128(bits_b));
+            __m128i weights = _mm_set1_epi32(weight_pair(kernel, k, kernel_size));
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), weights));
+        }
+        sum = _mm_srli_epi32(_mm_add_epi32(sum, half), FIXED_SHIFT);
+        __m128i u16 = _mm_packus_epi32(sum, sum);
+        int bits = _mm_cvtsi128_si32(_mm_packus_epi16(u16, u16));
+        __builtin_memcpy(dst + (size_t)x * 4, &bits, 4);
+    }
+}
+
+__attribute__((target("sse4.1")))
+static void blur_row_fixed_sse41(const unsigned char* src, unsigned char* dst,
+                                 const int16_t* kernel, int radius, int x_begin, int x_end) {
+    RADIUS_SWITCH(radius, blur_row_fixed_sse41_r, src, dst, kernel, x_begin, x_end);
+}
+
+// Fixed point, AVX2: four pixels per iteration. Each 128-bit lane holds two
+// pixels, so unpacklo/unpackhi yield pixels {0, 2} and {1, 3}; the lane-wise
+// packs put them back in order and one permute gathers the bytes.
+__attribute__((target("avx2")))
+static ALWAYS_INLINE void blur_row_fixed_avx2_r(const unsigned char* src, unsigned char* dst,
+                                                const int16_t* kernel, int x_begin, int x_end, int radius) {
+    int kernel_size = 2 * radius + 1;
+    const __m256i half = _mm256_set1_epi32(1 << (FIXED_SHIFT - 1));
+    int x = x_begin;
+
+    for (; x + 4 <= x_end; x += 4) {
+        const unsigned char* taps = src + (size_t)(x - radius) * 4;
+        __m256i sum02 = _mm256_setzero_si256();
+        __m256i sum13 = _mm256_setzero_si256();
+        UNROLL_TAPS
+        for (int k = 0; k < kernel_size; k += 2) {
+            __m256i weights = _mm256_set1_epi32(weight_pair(kernel, k, kernel_size));
+            __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(taps + k * 4)));
+            __m256i b = (k + 1 < kernel_size)
+                ? _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(taps + k * 4 + 4)))
+                : _mm256_setzero_si256();
+            sum02 = _mm256_add_epi32(sum02, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), weights));
+            sum13 = _mm256_add_epi32(sum13, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), weights));
+        }
+        sum02 = _mm256_srli_epi32(_mm256_add_epi32(sum02, half), FIXED_SHIFT);
+        sum13 = _mm256_srli_epi32(_mm256_add_epi32(sum13, half), FIXED_SHIFT);
+        __m256i u16 = _mm256_packus_epi32(sum02, sum13);
+        __m256i u8 = _mm256_permute4x64_epi64(_mm256_packus_epi16(u16, u16), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128((__m128i*)(dst + (size_t)x * 4), _mm256_castsi256_si128(u8));
+    }
+
+    if (x < x_end) {
+        blur_row_fixed_sse41_r(src, dst, kernel, x, x_end, radius);
+    }
+}
+
+__attribute__((target("avx2")))
+static void blur_row_fixed_avx2(const unsigned char* src, unsigned char* dst,
+                                const int16_t* kernel, int radius, int x_begin, int x_end) {
+    RADIUS_SWITCH(radius, blur_row_fixed_avx2_r, src, dst, kernel, x_begin, x_end);
+}
+
+#endif
+
+#if defined(BLUR_SIMD_NEON) && !defined(BLUR_NO_SIMD)
+
+// NEON: one pixel per iteration, the 4 channels in one float32x4
+static ALWAYS_INLINE void blur_row_neon_r(const unsigned char* src, unsigned char* dst,
+                                          const float* kernel, int x_begin, int x_end, int radius) {
+    int kernel_size = 2 * radius + 1;
+
+    for (int x = x_begin; x < x_end; x++) {
+        const unsigned char* taps = src + (size_t)(x - radius) * 4;
+        float32x4_t sum = vdupq_n_f32(0.0f);
+        UNROLL_TAPS
+        for (int k = 0; k < kernel_size; k++) {
+            uint32_t bits;
+            __builtin_memcpy(&bits, taps + k * 4, 4);
+            uint16x8_t u16 = vmovl_u8(vcreate_u8(bits));
+            float32x4_t pixel = vcvtq_f32_u32(vmovl_u16(vget_low_u16(u16)));
+            sum = vfmaq_n_f32(sum, pixel, kernel[k]);
+        }
+
+        // roundf() for non-negative lanes
+        float32x4_t t = vrndq_f32(sum);
+        uint32x4_t up = vcgeq_f32(vsubq_f32(sum, t), vdupq_n_f32(0.5f));
+        uint32x4_t rounded = vcvtq_u32_f32(vaddq_f32(t, vbslq_f32(up, vdupq_n_f32(1.0f), vdupq_n_f32(0.0f))));
+        uint8x8_t u8 = vqmovn_u16(vcombine_u16(vqmovn_u32(rounded), vdup_n_u16(0)));
+        uint32_t out = vget_lane_u32(vreinterpret_u32_u8(u8), 0);
+        __builtin_memcpy(dst + (size_t)x * 4, &out, 4);
+    }
+}
+
+static void blur_row_neon(const unsigned char* src, unsigned char* dst,
+                          const float* kernel, int radius, int x_begin, int x_end) {
+    RADIUS_SWITCH(radius, blur_row_neon_r, src, dst, kernel, x_begin, x_end);
+}
+
+
+// Fixed point, NEON: widening multiply-accumulate of two pixels per tap
+static ALWAYS_INLINE void blur_row_fixed_neon_r(const unsigned char* src, unsigned char* dst,
+                                                const int16_t* kernel, int x_begin, int x_end, int radius) {
+    int kernel_size = 2 * radius + 1;
+    int x = x_begin;
+
+    for (; x + 2 <= x_end; x += 2) {
+        const unsigned char* taps = src + (size_t)(x - radius) * 4;
+        uint32x4_t sum0 = vdupq_n_u32(0);
+        uint32x4_t sum1 = vdupq_n_u32(0);
+        UNROLL_TAPS
+        for (int k = 0; k < kernel_size; k++) {
+            uint16x8_t pixels = vmovl_u8(vld1_u8(taps + k * 4));
+            sum0 = vmlal_n_u16(sum0, vget_low_u16(pixels), (uint16_t)kernel[k]);
+            sum1 = vmlal_n_u16(sum1, vget_high_u16(pixels), (uint16_t)kernel[k]);
+        }
+        uint16x8_t u16 = vcombine_u16(vqmovn_u32(vrshrq_n_u32(sum0, FIXED_SHIFT)),
+                                      vqmovn_u32(vrshrq_n_u32(sum1, FIXED_SHIFT)));
+        vst1_u8(dst + (size_t)x * 4, vqmovn_u16(u16));
+    }
+
+    for (; x < x_end; x++) {
+        const unsigned char* taps = src + (size_t)(x - radius) * 4;
+        uint32x4_t sum = vdupq_n_u32(0);
+        UNROLL_TAPS
+        for (int k = 0; k < kernel_size; k++) {
+            uint32_t bits;
+            __builtin_memcpy(&bits, taps + k * 4, 4);
+            uint16x8_t pixel = vmovl_u8(vcreate_u8(bits));
+            sum = vmlal_n_u16(sum, vget_low_u16(pixel), (uint16_t)kernel[k]);
+        }
+        uint16x4_t u16 = vqmovn_u32(vrshrq_n_u32(sum, FIXED_SHIFT));
+        uint8x8_t u8 = vqmovn_u16(vcombine_u16(u16, vdup_n_u16(0)));
+        uint32_t out = vget_lane_u32(vreinterpret_u32_u8(u8), 0);
+        __builtin_memcpy(dst + (size_t)x * 4, &out, 4);
+    }
+}
+
+static void blur_row_fixed_neon(const unsigned char* src, unsigned char* dst,
+                                const int16_t* kernel, int radius, int x_begin, int x_end) {
+    RADIUS_SWITCH(radius, blur_row_fixed_neon_r, src, dst, kernel, x_begin, x_end);
+}
+
+#endif
+
+// Pick the widest row kernel the running CPU supports, NULL means scalar
+BlurRowFn blur_select_row_kernel(void) {
+#if defined(BLUR_NO_SIMD)
+    return NULL;
+#elif defined(BLUR_SIMD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return blur_row_avx2;
+    if (__builtin_cpu_supports("sse4.1")) return blur_row_sse41;
+    return NULL;
+#elif defined(BLUR_SIMD_NEON)
+    return blur_row_neon;
+#else
+    return NULL;
+#endif
+}
+
+// Fixed-point counterpart of blur_select_row_kernel
+BlurRowFixedFn blur_select_row_kernel_fixed(void) {
+#if defined(BLUR_NO_SIMD)
+    return NULL;
+#elif defined(BLUR_SIMD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return blur_row_fixed_avx2;
+    if (__builtin_cpu_supports("sse4.1")) return blur_row_fixed_sse41;
+    return NULL;
+#elif defined(BLUR_SIMD_NEON)
+    return blur_row_fixed_neon;
+#else
+    return NULL;
+#endif
+}
@@ -0,0 +1,162 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stddef.h>
+
+// Public interface of the filter library (libfilter.a / libfilter.so). The
+// filter_c and filter_bench binaries are built on the same entry points.
+// Nothing here writes to stdout: results and timings are returned or recorded
+// as profiler phases, and only warnings and errors go to stderr.
+
+// Interleaved 8-bit pixels, channels bytes per pixel. stride is the distance
+// in bytes between the starts of two rows, 0 for tightly packed rows, so an
+// Image can describe a caller's frame buffer or a window of one without a copy.
+typedef struct {
+    unsigned char* data;
+    int width;
+    int height;
+    int channels;
+    size_t stride;
+} Image;
+
+// Axis-aligned pixel rectangle
+typedef struct {
+    int x;
+    int y;
+    int width;
+    int height;
+} ImageRect;
+
+static inline size_t image_stride(const Image* img) {
+    return img->stride ? img->stride : (size_t)img->width * img->channels;
+}
+
+// First byte of row y
+static inline unsigned char* image_row(const Image* img, int y) {
+    return img->data + (size_t)y * image_stride(img);
+}
+
+// The pixels of frame inside rect, sharing frame's memory. rect must lie
+// within frame.
+static inline Image image_view(const Image* frame, ImageRect rect) {
+    Image view = {
+        .data = image_row(frame, rect.y) + (size_t)rect.x * frame->channels,
+        .width = rect.width,
+        .height = rect.height,
+        .channels = frame->channels,
+        .stride = image_stride(frame)
+    };
+    return view;
+}
+
+typedef struct ThreadPool ThreadPool;
+
+// Blur strategies, selected through gaussian_blur's mode argument
+typedef enum {
+    BLUR_TRANSPOSE,  // Horizontal pass, transpose, horizontal pass, transpose back
+    BLUR_FUSED,      // Horizontal pass, then a vertical pass straight over row-major data
+    BLUR_FIXED,      // Same passes as BLUR_TRANSPOSE with Q14 integer weights
+    BLUR_BOX,        // Successive box blurs from running sums, cost independent of radius
+    BLUR_TILED,      // BLUR_FUSED one cache-sized band at a time, no full-frame temporary
+    BLUR_GRAPH       // BLUR_FUSED as a task graph, vertical strips start as their rows are ready
+} BlurMode;
+
+// Kuwahara strategies, selected through apply_kuwahara_filter's mode argument
+typedef enum {
+    KUWAHARA_FULL_SAT,  // One summed-area table for the whole image
+    KUWAHARA_BANDED     // Per-band tables with a radius halo, memory bounded by band size
+} KuwaharaMode;
+
+// PNG row filters. PNG_FILTER_ADAPTIVE picks the filter per row with the
+// usual minimum-sum-of-absolute-differences heuristic.
+typedef enum {
+    PNG_FILTER_NONE,
+    PNG_FILTER_SUB,
+    PNG_FILTER_UP,
+    PNG_FILTER_AVERAGE,
+    PNG_FILTER_PAETH,
+    PNG_FILTER_ADAPTIVE
+} PngFilter;
+
+// Worker placement, see thread_pool_set_affinity
+typedef enum {
+    POOL_AFFINITY_NONE,     // Leave placement to the scheduler
+    POOL_AFFINITY_COMPACT,  // Fill one socket (and SMT siblings) before the next
+    POOL_AFFINITY_SCATTER   // Round-robin workers over sockets
+} PoolAffinity;
+
+// Random number generators for the Monte Carlo samples
+typedef enum {
+    MC_RNG_LCG,       // One LCG chain per worker, same formula across all languages
+    MC_RNG_SPLITMIX,  // Counter-based SplitMix64, no dependency between samples
+    MC_RNG_LCG8       // 8 interleaved LCG streams per worker, one SIMD register wide
+} MonteCarloRng;
+
+// Most stages run_pipeline accepts
+#define PIPELINE_MAX_STAGES 8
+
+// Per-stage cost of a run_pipeline call. stage_ns is worker time summed over
+// bands and workers, so it exceeds the wall time when workers run in parallel.
+typedef struct {
+    int num_stages;
+    char names[PIPELINE_MAX_STAGES][32];  // Stage specs, e.g. "blur:5"
+    long stage_ns[PIPELINE_MAX_STAGES];
+} PipelineStats;
+
+// Outcome of a Monte Carlo run
+typedef struct {
+    long samples;
+    long inside;             // Samples inside the quarter circle
+    double estimate;         // 4 * inside / samples, 0 without samples
+    double standard_error;   // Binomial error of estimate
+    const char* stop_reason; // Progressive runs: "target error", "deadline" or "sample cap"
+} MonteCarloResult;
+
+// Running totals of a progressive run, passed from the calling thread every
+// few hundred milliseconds
+typedef void (*MonteCarloProgressFn)(void* arg, long elapsed_ms, MonteCarloResult progress);
+
+// thread_pool.c
+ThreadPool* thread_pool_create(int num_workers);
+void thread_pool_destroy(ThreadPool* pool);
+int thread_pool_size(ThreadPool* pool);
+void thread_pool_set_grain(ThreadPool* pool, int grain);
+void thread_pool_set_huge_pages(ThreadPool* pool, int enabled);
+int thread_pool_set_affinity(ThreadPool* pool, PoolAffinity mode);
+void thread_pool_first_touch(ThreadPool* pool, void* buffer, size_t size);
+void thread_pool_enable_profile(ThreadPool* pool, int counters);
+int thread_pool_write_profile(ThreadPool* pool, const char* filename);
+
+// Sigma of the Gaussian behind gaussian_blur and of pipeline blur stages
+// that give none
+static inline float gaussian_default_sigma(int radius) {
+    return radius / 3.0f;
+}
+
+// Filters. src and dst must have the same size and must not overlap; either
+// may be a view into a larger frame. gaussian_blur_sigma takes the Gaussian's
+// sigma apart from the radius, which only sets the 2 * radius + 1 taps it is
+// cut off at; BLUR_BOX matches the sigma with its box widths instead.
+void gaussian_blur(Image* src, Image* dst, int radius, BlurMode mode, ThreadPool* pool);
+void gaussian_blur_sigma(Image* src, Image* dst, int radius, float sigma, BlurMode mode, ThreadPool* pool);
+ImageRect gaussian_blur_region(Image* src, Image* dst, int radius, float sigma, ImageRect dirty,
+                               ThreadPool* pool);
+void apply_kuwahara_filter(Image* src, Image* dst, int radius, KuwaharaMode mode, ThreadPool* pool);
+ImageRect apply_kuwahara_filter_region(Image* src, Image* dst, int radius, ImageRect dirty,
+                                       ThreadPool* pool);
+void apply_generalized_kuwahara(Image* src, Image* dst, int radius, ThreadPool* pool);
+int run_pipeline(Image* src, Image* dst, const char* spec, PipelineStats* stats, ThreadPool* pool);
+
+// monte_carlo.c. progress may be NULL.
+MonteCarloResult monte_carlo_operation(long total_samples, MonteCarloRng rng, ThreadPool* pool);
+MonteCarloResult monte_carlo_progressive(long max_samples, double target_error, long deadline_ms,
+                                         MonteCarloRng rng, MonteCarloProgressFn progress,
+                                         void* progress_arg, ThreadPool* pool);
+
+// image.c and png_encode.c. free_image only takes images from load_image.
+Image* load_image(const char* filename);
+int save_image(const char* filename, Image* img);
+void free_image(Image* img);
+int save_png(const char* filename, Image* img, int level, PngFilter filter, ThreadPool* pool);
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef FILTER_INTERNAL_H
+#define FILTER_INTERNAL_H
+
+#include <stdint.h>
+
+#include "filter.h"
+
+// Helpers shared by the filter sources. Not installed with the library and
+// not part of its interface, see filter.h for that.
+
+// Kernels that take a channel count cn are forced inline into one wrapper per
+// supported count (1, 3 and 4), so every copy is compiled with cn as a
+// constant and its channel loops unroll for the native pixel size
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#define CHANNEL_SWITCH(channels, fn, ...)      \
+    switch (channels) {                        \
+    case 1: fn(__VA_ARGS__, 1); break;         \
+    case 3: fn(__VA_ARGS__, 3); break;         \
+    default: fn(__VA_ARGS__, 4); break;        \
+    }
+
+// Radius specialization on top of CHANNEL_SWITCH: the common radii 3, 5 and
+// 8 get their own copies with the tap loops fully unrolled, any other radius
+// runs the generic loop. KERNEL_SWITCH appends both cn and the radius. blur.c
+// and the SIMD row kernels in blur_simd.c share this list.
+#define RADIUS_SWITCH(radius, fn, ...)         \
+    switch (radius) {                          \
+    case 3: fn(__VA_ARGS__, 3); break;         \
+    case 5: fn(__VA_ARGS__, 5); break;         \
+    case 8: fn(__VA_ARGS__, 8); break;         \
+    default: fn(__VA_ARGS__, radius); break;   \
+    }
+#define KERNEL_SWITCH(channels, radius, fn, ...)                     \
+    switch (channels) {                                              \
+    case 1: RADIUS_SWITCH(radius, fn, __VA_ARGS__, 1); break;        \
+    case 3: RADIUS_SWITCH(radius, fn, __VA_ARGS__, 3); break;        \
+    default: RADIUS_SWITCH(radius, fn, __VA_ARGS__, 4); break;       \
+    }
+
+// Full unroll of the tap loops up to radius 8 (17 taps), past GCC's default
+// complete-peeling limit of 16 iterations
+#define UNROLL_TAPS _Pragma("GCC unroll 17")
+
+// Fractional bits of the fixed-point blur kernel, weights sum to exactly
+// 1 << FIXED_SHIFT
+#define FIXED_SHIFT 14
+
+// Blurs interior pixels [x_begin, x_end) of one RGBA row, where every tap is
+// inside the row. src and dst point at pixel 0 of their rows.
+typedef void (*BlurRowFn)(const unsigned char* src, unsigned char* dst,
+                          const float* kernel, int radius, int x_begin, int x_end);
+
+// Same contract for Q14 fixed-point kernels
+typedef void (*BlurRowFixedFn)(const unsigned char* src, unsigned char* dst,
+                               const int16_t* kernel, int radius, int x_begin, int x_end);
+
+// Channels the filters work on: alpha is carried through, not filtered
+static inline int color_channels(int channels) {
+    return channels == 1 ? 1 : 3;
+}
+
+// rect grown by margin on every side and clipped to a width x height image
+static inline ImageRect clip_rect(ImageRect rect, int margin, int width, int height) {
+    int x0 = rect.x - margin > 0 ? rect.x - margin : 0;
+    int y0 = rect.y - margin > 0 ? rect.y - margin : 0;
+    int x1 = rect.x + rect.width + margin < width ? rect.x + rect.width + margin : width;
+    int y1 = rect.y + rect.height + margin < height ? rect.y + rect.height + margin : height;
+    ImageRect clipped = {x0, y0, x1 > x0 ? x1 - x0 : 0, y1 > y0 ? y1 - y0 : 0};
+    return clipped;
+}
+
+#endif
@@ -0,0 +1,297 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "filter.h"
+#include "filter_internal.h"
+
+typedef void (*PoolRangeFn)(void* arg, int begin, int end, int worker);
+
+// External functions from thread_pool.c
+void thread_pool_for(ThreadPool* pool, int count, PoolRangeFn body, void* arg);
+void thread_pool_set_phase(ThreadPool* pool, const char* name);
+
+// Generalized Kuwahara (Papari et al.): the disc around a pixel is split into
+// N overlapping, smoothly weighted sectors instead of 4 hard quadrants, and
+// the output blends the sector means with weights that fall off sharply with
+// each sector's variance.
+#define SECTORS 8
+
+// Taps sample the disc on a grid of cell x cell boxes, cell =
+// ceil(radius / GRID_RADIUS), and read each box's mean of v and v^2 from
+// box-filtered planes built once per call. The tap count never exceeds the 49
+// of a radius GRID_RADIUS disc and the box planes cost O(cell) per pixel, so
+// large radii cost about as much as small ones. Up to GRID_RADIUS the cells
+// are single pixels and the sector statistics are exact.
+#define GRID_RADIUS 4
+
+// Sectors are blended with weight 1 / (1 + (variance / 255)^(q / 2)). The
+// sharpness q is fixed at 8 so the power is two squarings.
+
+// One cell offset with its weight in every sector. Weights for all sectors
+// sit side by side so each tap updates the accumulators of all sectors with
+// SECTORS-wide vector operations.
+typedef struct {
+    int dx;
+    int dy;
+    float weight[SECTORS];
+} SectorTap;
+
+typedef struct {
+    SectorTap* taps;
+    int num_taps;
+    int radius;
+    int cell;   // Box side in pixels, taps are multiples of it apart
+    int reach;  // Largest |dx| or |dy| over the taps
+} SectorKernel;
+
+typedef struct {
+    Image* src;
+    Image* dst;
+    SectorKernel* kernel;
+    float* row_sums;  // Horizontal box sums, laid out as cells
+    float* cells;     // Per pixel: box means of each color, then of its square
+} WorkerContext;
+
+// Precompute the sector weights for a radius. Sector i covers the angles
+// within 2 pi / N of its axis with a cos^2 lobe, so neighbouring lobes
+// overlap by half and the lobes sum to 1 at every angle. A radial Gaussian
+// (sigma = radius / 2) fades the disc edge, and each sector is normalized.
+// Weights are taken at the cell centers.
+SectorKernel* create_sector_kernel(int radius) {
+    int cell = radius > GRID_RADIUS ? (radius + GRID_RADIUS - 1) / GRID_RADIUS : 1;
+    int grid = radius / cell;
+    int side = 2 * grid + 1;
+    SectorKernel* kernel = (SectorKernel*)malloc(sizeof(SectorKernel));
+    kernel->taps = (SectorTap*)malloc(side * side * sizeof(SectorTap));
+    kernel->num_taps = 0;
+    kernel->radius = radius;
+    kernel->cell = cell;
+    kernel->reach = grid * cell;
+
+    float sigma = radius > 0 ? radius / 2.0f : 1.0f;
+    float total[SECTORS] = {0};
+
+    for (int gy = -grid; gy <= grid; gy++) {
+        for (int gx = -grid; gx <= grid; gx++) {
+            int dx = gx * cell;
+            int dy = gy * cell;
+            int dist_sq = dx * dx + dy * dy;
+            if (dist_sq > radius * radius) continue;
+
+            SectorTap* tap = &kernel->taps[kernel->num_taps++];
+            tap->dx = dx;
+            tap->dy = dy;
+
+            float radial = expf(-dist_sq / (2.0f * sigma * sigma));
+            float angle = atan2f((float)dy, (float)dx);
+
+            for (int i = 0; i < SECTORS; i++) {
+                float lobe;
+                if (dist_sq == 0) {
+                    lobe = 1.0f / SECTORS;
+                } else {
+                    float delta = angle - 2.0f * (float)M_PI * i / SECTORS;
+                    delta = remainderf(delta, 2.0f * (float)M_PI);
+                    float half_width = 2.0f * (float)M_PI / SECTORS;
+                    float c = cosf(delta * SECTORS / 4.0f);
+                    lobe = (fabsf(delta) < half_width) ? c * c : 0.0f;
+                }
+                tap->weight[i] = radial * lobe;
+                total[i] += tap->weight[i];
+            }
+        }
+    }
+
+    for (int t = 0; t < kernel->num_taps; t++) {
+        for (int i = 0; i < SECTORS; i++) {
+            kernel->taps[t].weight[i] /= total[i];
+        }
+    }
+
+    return kernel;
+}
+
+void free_sector_kernel(SectorKernel* kernel) {
+    if (kernel) {
+        free(kernel->taps);
+        free(kernel);
+    }
+}
+
+// Box sums of v and v^2 along each row, cell pixels wide and centered. An
+// even cell reaches half a pixel further each side, so its end taps count
+// half. Rows clamp at the image edges like the taps do.
+static ALWAYS_INLINE void box_rows_horizontal(WorkerContext* ctx, int start_row, int end_row, int cn) {
+    Image* src = ctx->src;
+    int colors = color_channels(cn);
+    int stats = 2 * colors;
+    int w = src->width;
+    int cell = ctx->kernel->cell;
+    int half = cell / 2;
+    float end_weight = (cell % 2) ? 1.0f : 0.5f;
+    // Single-pixel cells need no vertical pass
+    float* out = cell == 1 ? ctx->cells : ctx->row_sums;
+
+    for (int y = start_row; y < end_row; y++) {
+        const unsigned char* row = image_row(src, y);
+        float* dst = out + (size_t)y * w * stats;
+        for (int x = 0; x < w; x++) {
+            float sum[3] = {0, 0, 0};
+            float sum_sq[3] = {0, 0, 0};
+            for (int k = -half; k <= half; k++) {
+                int sx = x + k;
+                sx = sx < 0 ? 0 : (sx >= w ? w - 1 : sx);
+                float weight = (k == -half || k == half) ? end_weight : 1.0f;
+                for (int ch = 0; ch < colors; ch++) {
+                    float v = row[(size_t)sx * cn + ch];
+                    sum[ch] += weight * v;
+                    sum_sq[ch] += weight * v * v;
+                }
+            }
+            for (int ch = 0; ch < colors; ch++) {
+                dst[x * stats + ch] = sum[ch];
+                dst[x * stats + colors + ch] = sum_sq[ch];
+            }
+        }
+    }
+}
+
+void box_horizontal_worker(void* arg, int start_row, int end_row, int worker) {
+    (void)worker;
+    WorkerContext* ctx = (WorkerContext*)arg;
+    CHANNEL_SWITCH(ctx->src->channels, box_rows_horizontal, ctx, start_row, end_row);
+}
+
+// Box sums of the row sums down each column, scaled to means
+void box_vertical_worker(void* arg, int start_row, int end_row, int worker) {
+    (void)worker;
+    WorkerContext* ctx = (WorkerContext*)arg;
+    int h = ctx->src->height;
+    size_t row_floats = (size_t)ctx->src->width * 2 * color_channels(ctx->src->channels);
+    int cell = ctx->kernel->cell;
+    int half = cell / 2;
+    float end_weight = (cell % 2) ? 1.0f : 0.5f;
+    float scale = 1.0f / ((float)cell * cell);
+
+    for (int y = start_row; y < end_row; y++) {
+        float* dst = ctx->cells + (size_t)y * row_floats;
+        memset(dst, 0, row_floats * sizeof(float));
+        for (int k = -half; k <= half; k++) {
+            int sy = y + k;
+            sy = sy < 0 ? 0 : (sy >= h ? h - 1 : sy);
+            float weight = ((k == -half || k == half) ? end_weight : 1.0f) * scale;
+            const float* src_row = ctx->row_sums + (size_t)sy * row_floats;
+            for (size_t i = 0; i < row_floats; i++) {
+                dst[i] += weight * src_row[i];
+            }
+        }
+    }
+}
+
+// Sector means and variances for one pixel, blended by variance weight.
+// interior means every tap is inside the image and needs no clamping. Gray
+// images have one color channel, alpha (cn == 4) is copied through.
+static ALWAYS_INLINE void generalized_kuwahara_pixel(WorkerContext* ctx, int x, int y, int interior, int cn) {
+    SectorKernel* kernel = ctx->kernel;
+    int colors = color_channels(cn);
+    int stats = 2 * colors;
+    int w = ctx->src->width;
+    int h = ctx->src->height;
+    float mean[3][SECTORS] = {{0}};
+    float mean_sq[3][SECTORS] = {{0}};
+
+    for (int t = 0; t < kernel->num_taps; t++) {
+        SectorTap* tap = &kernel->taps[t];
+        int sx = x + tap->dx;
+        int sy = y + tap->dy;
+        if (!interior) {
+            sx = sx < 0 ? 0 : (sx >= w ? w - 1 : sx);
+            sy = sy < 0 ? 0 : (sy >= h ? h - 1 : sy);
+        }
+
+        const float* cell = ctx->cells + ((size_t)sy * w + sx) * stats;
+        for (int ch = 0; ch < colors; ch++) {
+            float v = cell[ch];
+            float v_sq = cell[colors + ch];
+            for (int i = 0; i < SECTORS; i++) {
+                mean[ch][i] += tap->weight[i] * v;
+                mean_sq[ch][i] += tap->weight[i] * v_sq;
+            }
+        }
+    }
+
+    float weight_sum = 0.0f;
+    float out[3] = {0, 0, 0};
+    for (int i = 0; i < SECTORS; i++) {
+        float variance = 0.0f;
+        for (int ch = 0; ch < colors; ch++) {
+            float v = mean_sq[ch][i] - mean[ch][i] * mean[ch][i];
+            variance += v > 0.0f ? v : 0.0f;
+        }
+        // A gray pixel weighs sectors as its RGB expansion would, three
+        // equal channel variances
+        if (colors == 1) variance = variance + variance + variance;
+
+        // (variance / 255)^4
+        float t = variance / 255.0f;
+        float t_sq = t * t;
+        float alpha = 1.0f / (1.0f + t_sq * t_sq);
+
+        weight_sum += alpha;
+        for (int ch = 0; ch < colors; ch++) {
+            out[ch] += alpha * mean[ch][i];
+        }
+    }
+
+    unsigned char* dst_pixel = image_row(ctx->dst, y) + (size_t)x * cn;
+    for (int ch = 0; ch < colors; ch++) {
+        float v = out[ch] / weight_sum;
+        dst_pixel[ch] = (unsigned char)fminf(255.0f, fmaxf(0.0f, v + 0.5f));
+    }
+    if (cn == 4) dst_pixel[3] = image_row(ctx->src, y)[(size_t)x * 4 + 3];
+}
+
+static ALWAYS_INLINE void generalized_kuwahara_rows(WorkerContext* ctx, int start_row, int end_row, int cn) {
+    int w = ctx->src->width;
+    int h = ctx->src->height;
+    int reach = ctx->kernel->reach;
+
+    for (int y = start_row; y < end_row; y++) {
+        int interior_row = y >= reach && y + reach < h;
+        for (int x = 0; x < w; x++) {
+            int interior = interior_row && x >= reach && x + reach < w;
+            generalized_kuwahara_pixel(ctx, x, y, interior, cn);
+        }
+    }
+}
+
+void generalized_kuwahara_worker(void* arg, int start_row, int end_row, int worker) {
+    (void)worker;
+    WorkerContext* ctx = (WorkerContext*)arg;
+    CHANNEL_SWITCH(ctx->src->channels, generalized_kuwahara_rows, ctx, start_row, end_row);
+}
+
+void apply_generalized_kuwahara(Image* src, Image* dst, int radius, ThreadPool* pool) {
+    SectorKernel* kernel = create_sector_kernel(radius);
+    size_t plane_bytes = (size_t)src->width * src->height * 2 * color_channels(src->channels) * sizeof(float);
+
+    WorkerContext ctx = {
+        .src = src,
+        .dst = dst,
+        .kernel = kernel,
+        .row_sums = kernel->cell > 1 ? (float*)malloc(plane_bytes) : NULL,
+        .cells = (float*)malloc(plane_bytes)
+    };
+    thread_pool_set_phase(pool, "generalized_cells");
+    thread_pool_for(pool, src->height, box_horizontal_worker, &ctx);
+    if (kernel->cell > 1) thread_pool_for(pool, src->height, box_vertical_worker, &ctx);
+
+    thread_pool_set_phase(pool, "filter_generalized");
+    thread_pool_for(pool, src->height, generalized_kuwahara_worker, &ctx);
+
+    free(ctx.row_sums);
+    free(ctx.cells);
+    free_sector_kernel(kernel);
+}
@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "../stb/stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "../stb/stb_image_write.h"
+
+#include "filter.h"
+
+// Image I/O and timing shared by filter_c and filter_bench
+
+// Image returned by load_image. PAM files are mapped rather than decoded, so
+// the pixels may live inside a file mapping instead of an stb allocation.
+typedef struct {
+    Image image;  // Must stay first, callers only see this member
+    void* map;
+    size_t map_len;
+} LoadedImage;
+
+int has_extension(const char* filename, const char* ext) {
+    size_t len = strlen(filename);
+    size_t ext_len = strlen(ext);
+    return len >= ext_len && strcasecmp(filename + len - ext_len, ext) == 0;
+}
+
+// Read one PAM header token, skipping whitespace and # comments. Returns 0
+// past the end of the mapping.
+static int pam_token(const char* text, size_t len, size_t* pos, char* token, size_t token_size) {
+    while (*pos < len) {
+        if (text[*pos] == '#') {
+            while (*pos < len && text[*pos] != '\n') (*pos)++;
+        } else if (isspace((unsigned char)text[*pos])) {
+            (*pos)++;
+        } else {
+            break;
+        }
+    }
+    size_t n = 0;
+    while (*pos < len && !isspace((unsigned char)text[*pos])) {
+        if (n + 1 < token_size) token[n++] = text[*pos];
+        (*pos)++;
+    }
+    token[n] = '\0';
+    return n > 0;
+}
+
+// Map an 8-bit gray, RGB or RGBA PAM (P7) file. Pixels are used in place: the
+// mapping is private, so nothing is decoded or copied until a page is written to.
+static LoadedImage* load_pam(const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 3) {
+        close(fd);
+        return NULL;
+    }
+    size_t map_len = (size_t)st.st_size;
+    void* map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    const char* text = (const char*)map;
+    size_t pos = 0;
+    char token[32];
+    int width = 0, height = 0, depth = 0, maxval = 0, ended = 0;
+
+    if (pam_token(text, map_len, &pos, token, sizeof(token)) && strcmp(token, "P7") == 0) {
+        while (pam_token(text, map_len, &pos, token, sizeof(token))) {
+            if (strcmp(token, "ENDHDR") == 0) {
+                ended = 1;
+                break;
+            }
+            char value[32];
+            if (!pam_token(text, map_len, &pos, value, sizeof(value))) break;
+            if (strcmp(token, "WIDTH") == 0) width = atoi(value);
+            else if (strcmp(token, "HEIGHT") == 0) height = atoi(value);
+            else if (strcmp(token, "DEPTH") == 0) depth = atoi(value);
+            else if (strcmp(token, "MAXVAL") == 0) maxval = atoi(value);
+        }
+    }
+
+    // Pixel data starts after the single newline that ends ENDHDR
+    pos++;
+    if (!ended || width <= 0 || height <= 0 || (depth != 1 && depth != 3 && depth != 4) ||
+        maxval != 255 || pos + (size_t)width * height * depth > map_len) {
+        munmap(map, map_len);
+        return NULL;
+    }
+
+    LoadedImage* loaded = (LoadedImage*)malloc(sizeof(LoadedImage));
+    loaded->image.data = (unsigned char*)map + pos;
+    loaded->image.width = width;
+    loaded->image.height = height;
+    loaded->image.channels = depth;
+    loaded->image.stride = (size_t)width * depth;
+    loaded->map = map;
+    loaded->map_len = map_len;
+    return loaded;
+}
+
+// Write header and pixels straight from the buffer with write(2)
+static int save_pam(const char* filename, Image* img) {
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return 0;
+
+    const char* tuple_type = img->channels == 1 ? "GRAYSCALE" : img->channels == 3 ? "RGB" : "RGB_ALPHA";
+    char header[128];
+    int header_len = snprintf(header, sizeof(header),
+                              "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL 255\nTUPLTYPE %s\nENDHDR\n",
+                              img->width, img->height, img->channels, tuple_type);
+
+    int ok = write(fd, header, header_len) == header_len;
+
+    // One write for packed pixels, one per row for a view into a wider frame
+    size_t row_len = (size_t)img->width * img->channels;
+    int packed = image_stride(img) == row_len;
+    int chunks = packed ? 1 : img->height;
+    for (int y = 0; ok && y < chunks; y++) {
+        const unsigned char* data = image_row(img, y);
+        size_t remaining = packed ? row_len * img->height : row_len;
+        while (remaining > 0) {
+            ssize_t written = write(fd, data, remaining);
+            if (written <= 0) {
+                ok = 0;
+                break;
+            }
+            data += written;
+            remaining -= (size_t)written;
+        }
+    }
+
+    return (close(fd) == 0) && ok;
+}
+
+Image* load_image(const char* filename) {
+    if (has_extension(filename, ".pam")) {
+        LoadedImage* loaded = load_pam(filename);
+        return loaded ? &loaded->image : NULL;
+    }
+
+    // Gray, RGB and RGBA stay in their native layout. Gray with alpha has no
+    // filter path of its own and is widened to RGBA.
+    int width, height, channels;
+    if (!stbi_info(filename, &width, &height, &channels)) {
+        return NULL;
+    }
+    if (channels == 2) channels = 4;
+    unsigned char* data = stbi_load(filename, &width, &height, NULL, channels);
+    if (!data) {
+        return NULL;
+    }
+
+    LoadedImage* loaded = (LoadedImage*)malloc(sizeof(LoadedImage));
+    loaded->image.width = width;
+    loaded->image.height = height;
+    loaded->image.channels = channels;
+    loaded->image.stride = (size_t)width * channels;
+    loaded->image.data = data;
+    loaded->map = NULL;
+    loaded->map_len = 0;
+
+    return &loaded->image;
+}
+
+// PNG through stb, or PAM for .pam filenames
+int save_image(const char* filename, Image* img) {
+    if (has_extension(filename, ".pam")) {
+        return save_pam(filename, img);
+    }
+    return stbi_write_png(filename, img->width, img->height, img->channels,
+                         img->data, (int)image_stride(img));
+}
+
+// Only for images returned by load_image
+void free_image(Image* img) {
+    if (img) {
+        LoadedImage* loaded = (LoadedImage*)img;
+        if (loaded->map) {
+            munmap(loaded->map, loaded->map_len);
+        } else if (img->data) {
+            stbi_image_free(img->data);
+        }
+        free(loaded);
+    }
+}
+
+long get_time_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
@@ -1,46 +1,84 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <math.h>
-#include <pthread.h>
 #include <time.h>
 #include <float.h>
 
-typedef struct {
-    unsigned char* data;
-    int width;
-    int height;
-    int channels;
-} Image;
+#include "filter.h"
+#include "filter_internal.h"
 
-// External function from main.c
-extern long get_time_ms();
+// Largest radius for which a quadrant's sum of squares, (r + 1)^2 * 255^2,
+// still fits in 32 bits
+#define KUWAHARA_MAX_RADIUS 256
 
-typedef struct {
-    float* sum;
-    float* sum_sq;
-    int width;
+// Pixels evaluated together by the vectorized interior path
+#define KUWAHARA_BLOCK 8
+
+// Summed-area tables in unsigned 32-bit integers. Entries wrap on large
+// images, but modular arithmetic keeps every box sum exact as long as the box
+// itself fits in 32 bits, which KUWAHARA_MAX_RADIUS guarantees. Same memory
+// as float, with no precision loss at any resolution.
+//
+// Each table is stored as one plane per color channel (3, or 1 for gray
+// images) of (cols + 1) * (rows + 1)
+// entries, so neighbouring pixels' corners are contiguous in memory. A table
+// may cover only a window of the image, rows [row0, row0 + rows) and columns
+// [col0, col0 + cols).
+typedef struct IntegralImage {
+    uint32_t* sum;
+    uint32_t* sum_sq;
+    size_t plane;  // Entries per channel plane
+    int colors;    // Channel planes, the image's channels less alpha
+    int width;     // Size of the whole image, used for clamping
     int height;
+    int row0;      // First image row covered
+    int rows;      // Image rows covered, at most the rows allocated for
+    int col0;      // First image column covered
+    int cols;      // Image columns covered, also the row stride minus one
 } IntegralImage;
 
+// Output rows per locally built table in KUWAHARA_BANDED mode
+#define KUWAHARA_BAND_ROWS 64
+
+typedef void (*PoolRangeFn)(void* arg, int begin, int end, int worker);
+
+// External functions from thread_pool.c
+void thread_pool_for(ThreadPool* pool, int count, PoolRangeFn body, void* arg);
+void thread_pool_set_phase(ThreadPool* pool, const char* name);
+
 typedef struct {
     Image* src;
     Image* dst;
     IntegralImage* integral;
     int radius;
-    int start_row;
-    int end_row;
+    ImageRect rect;  // Output window of kuwahara_region_worker
 } WorkerContext;
 
-IntegralImage* create_integral_image(int width, int height) {
+// Table for a window of cols x rows pixels of a width x height image, placed
+// at (0, 0) until rebased with col0 and row0
+static IntegralImage* create_integral_window(int width, int height, int cols, int rows, int colors) {
     IntegralImage* img = (IntegralImage*)malloc(sizeof(IntegralImage));
     img->width = width;
     img->height = height;
-    img->sum = (float*)calloc((width + 1) * (height + 1) * 3, sizeof(float));
-    img->sum_sq = (float*)calloc((width + 1) * (height + 1) * 3, sizeof(float));
+    img->row0 = 0;
+    img->rows = rows;
+    img->col0 = 0;
+    img->cols = cols;
+    img->plane = (size_t)(cols + 1) * (rows + 1);
+    img->colors = colors;
+    img->sum = (uint32_t*)calloc(img->plane * colors, sizeof(uint32_t));
+    img->sum_sq = (uint32_t*)calloc(img->plane * colors, sizeof(uint32_t));
     return img;
 }
 
+// Table for image rows [0, rows) of a width x height image with channels
+// channels, rebased with row0
+IntegralImage* create_integral_image(int width, int height, int rows, int channels) {
+    return create_integral_window(width, height, width, rows, color_channels(channels));
+}
+
 void free_integral_image(IntegralImage* img) {
     if (img) {
         free(img->sum);
@@ -49,71 +87,124 @@ void free_integral_image(IntegralImage* img) {
     }
 }
 
-void build_integral_images(Image* src, IntegralImage* integral) {
-    int w = src->width;
-    int h = src->height;
-    int iw = integral->width + 1;
-    
-    for (int y = 1; y <= h; y++) {
-        for (int x = 1; x <= w; x++) {
-            for (int ch = 0; ch < 3; ch++) {
-                int src_idx = ((y - 1) * w + (x - 1)) * 4 + ch;
-                float val = src->data[src_idx];
-                
-                int idx = (y * iw + x) * 3 + ch;
-                int idx_up = ((y - 1) * iw + x) * 3 + ch;
-                int idx_left = (y * iw + (x - 1)) * 3 + ch;
-                int idx_diag = ((y - 1) * iw + (x - 1)) * 3 + ch;
-                
-                integral->sum[idx] = val + 
-                    integral->sum[idx_up] + 
-                    integral->sum[idx_left] - 
-                    integral->sum[idx_diag];
-                
-                integral->sum_sq[idx] = val * val + 
-                    integral->sum_sq[idx_up] + 
-                    integral->sum_sq[idx_left] - 
-                    integral->sum_sq[idx_diag];
+typedef struct {
+    Image* src;
+    IntegralImage* integral;
+} IntegralContext;
+
+// Phase 1: prefix sums along table rows [start_row, end_row), which hold
+// image rows row0 + start_row onwards, from column col0
+void integral_rows_worker(void* arg, int start_row, int end_row, int worker) {
+    (void)worker;
+    IntegralContext* ctx = (IntegralContext*)arg;
+    Image* src = ctx->src;
+    IntegralImage* integral = ctx->integral;
+    int w = integral->cols;
+    int cn = src->channels;
+    size_t iw = integral->cols + 1;
+
+    for (int y = start_row + 1; y <= end_row; y++) {
+        const unsigned char* src_row = image_row(src, integral->row0 + y - 1) + (size_t)integral->col0 * cn;
+
+        for (int ch = 0; ch < integral->colors; ch++) {
+            uint32_t* sum = integral->sum + ch * integral->plane + y * iw;
+            uint32_t* sum_sq = integral->sum_sq + ch * integral->plane + y * iw;
+            uint32_t row_sum = 0;
+            uint32_t row_sum_sq = 0;
+
+            for (int x = 1; x <= w; x++) {
+                uint32_t val = src_row[(x - 1) * cn + ch];
+                row_sum += val;
+                row_sum_sq += val * val;
+                sum[x] = row_sum;
+                sum_sq[x] = row_sum_sq;
+            }
+        }
+    }
+}
+
+// Phase 2: running sums down each table column x in [start_col, end_col)
+void integral_columns_worker(void* arg, int start_col, int end_col, int worker) {
+    (void)worker;
+    IntegralContext* ctx = (IntegralContext*)arg;
+    IntegralImage* integral = ctx->integral;
+    size_t iw = integral->cols + 1;
+
+    for (int ch = 0; ch < integral->colors; ch++) {
+        for (int y = 2; y <= integral->rows; y++) {
+            const uint32_t* sum_up = integral->sum + ch * integral->plane + (y - 1) * iw;
+            const uint32_t* sum_sq_up = integral->sum_sq + ch * integral->plane + (y - 1) * iw;
+            uint32_t* sum = integral->sum + ch * integral->plane + y * iw;
+            uint32_t* sum_sq = integral->sum_sq + ch * integral->plane + y * iw;
+
+            for (int x = start_col + 1; x <= end_col; x++) {
+                sum[x] += sum_up[x];
+                sum_sq[x] += sum_sq_up[x];
             }
         }
     }
 }
 
+// Two-phase parallel build: independent row scans, then independent column
+// scans over the row results. Row and column 0 stay zero from calloc. Covers
+// the window integral was placed at, the whole image for a full table.
+void build_integral_images(Image* src, IntegralImage* integral, ThreadPool* pool) {
+    IntegralContext ctx = {
+        .src = src,
+        .integral = integral
+    };
+    thread_pool_set_phase(pool, "sat_rows");
+    thread_pool_for(pool, integral->rows, integral_rows_worker, &ctx);
+    thread_pool_set_phase(pool, "sat_columns");
+    thread_pool_for(pool, integral->cols, integral_columns_worker, &ctx);
+}
+
 void get_region_stats(IntegralImage* integral, int x1, int y1, int x2, int y2, 
                      float* mean, float* variance, int channel) {
-    int iw = integral->width + 1;
+    int iw = integral->cols + 1;
     
     x1 = (x1 < 0) ? 0 : x1;
     y1 = (y1 < 0) ? 0 : y1;
     x2 = (x2 >= integral->width) ? integral->width - 1 : x2;
     y2 = (y2 >= integral->height) ? integral->height - 1 : y2;
     
+    // Image coordinates to table coordinates
+    y1 -= integral->row0;
+    y2 -= integral->row0;
+    x1 -= integral->col0;
+    x2 -= integral->col0;
+    
     x1++; y1++; x2++; y2++;
     
-    int idx_br = (y2 * iw + x2) * 3 + channel;
-    int idx_bl = (y2 * iw + x1 - 1) * 3 + channel;
-    int idx_tr = ((y1 - 1) * iw + x2) * 3 + channel;
-    int idx_tl = ((y1 - 1) * iw + x1 - 1) * 3 + channel;
+    const uint32_t* plane_sum = integral->sum + channel * integral->plane;
+    const uint32_t* plane_sum_sq = integral->sum_sq + channel * integral->plane;
+    size_t idx_br = (size_t)y2 * iw + x2;
+    size_t idx_bl = (size_t)y2 * iw + x1 - 1;
+    size_t idx_tr = (size_t)(y1 - 1) * iw + x2;
+    size_t idx_tl = (size_t)(y1 - 1) * iw + x1 - 1;
     
-    float sum = integral->sum[idx_br] - integral->sum[idx_bl] - 
-                integral->sum[idx_tr] + integral->sum[idx_tl];
-    float sum_sq = integral->sum_sq[idx_br] - integral->sum_sq[idx_bl] - 
-                   integral->sum_sq[idx_tr] + integral->sum_sq[idx_tl];
+    uint32_t sum = plane_sum[idx_br] - plane_sum[idx_bl] - 
+                   plane_sum[idx_tr] + plane_sum[idx_tl];
+    uint32_t sum_sq = plane_sum_sq[idx_br] - plane_sum_sq[idx_bl] - 
+                      plane_sum_sq[idx_tr] + plane_sum_sq[idx_tl];
     
-    float area = (x2 - x1 + 1) * (y2 - y1 + 1);
+    int64_t area = (int64_t)(x2 - x1 + 1) * (y2 - y1 + 1);
     if (area > 0) {
-        *mean = sum / area;
-        *variance = (sum_sq / area) - (*mean * *mean);
-        if (*variance < 0) *variance = 0;
+        // area * variance * area, exact in 64 bits
+        int64_t spread = area * sum_sq - (int64_t)sum * sum;
+        *mean = (float)sum / area;
+        *variance = (float)spread / (float)(area * area);
     } else {
         *mean = 0;
         *variance = 0;
     }
 }
 
-void kuwahara_filter_pixel(Image* src, Image* dst, IntegralImage* integral, 
-                          int x, int y, int radius) {
-    float min_variance[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+// One pixel of a cn-channel image, with clamping at the image edges
+static ALWAYS_INLINE void kuwahara_filter_pixel(Image* src, Image* dst, IntegralImage* integral,
+                                                int x, int y, int radius, int cn) {
+    int colors = color_channels(cn);
+    float min_total = INFINITY;
     float best_mean[3] = {0, 0, 0};
     
     int quadrants[4][4] = {
@@ -127,7 +218,7 @@ void kuwahara_filter_pixel(Image* src, Image* dst, IntegralImage* integral,
         float mean[3], variance[3];
         float total_variance = 0;
         
-        for (int ch = 0; ch < 3; ch++) {
+        for (int ch = 0; ch < colors; ch++) {
             get_region_stats(integral, 
                            quadrants[q][0], quadrants[q][1],
                            quadrants[q][2], quadrants[q][3],
@@ -135,62 +226,259 @@ void kuwahara_filter_pixel(Image* src, Image* dst, IntegralImage* integral,
             total_variance += variance[ch];
         }
         
-        if (total_variance < min_variance[0] + min_variance[1] + min_variance[2]) {
-            for (int ch = 0; ch < 3; ch++) {
-                min_variance[ch] = variance[ch];
+        if (total_variance < min_total) {
+            min_total = total_variance;
+            for (int ch = 0; ch < colors; ch++) {
                 best_mean[ch] = mean[ch];
             }
         }
     }
     
-    int dst_idx = (y * dst->width + x) * 4;
-    for (int ch = 0; ch < 3; ch++) {
-        dst->data[dst_idx + ch] = (unsigned char)fminf(255.0f, fmaxf(0.0f, best_mean[ch]));
+    unsigned char* out = image_row(dst, y) + (size_t)x * cn;
+    for (int ch = 0; ch < colors; ch++) {
+        out[ch] = (unsigned char)fminf(255.0f, fmaxf(0.0f, best_mean[ch]));
     }
-    dst->data[dst_idx + 3] = src->data[(y * src->width + x) * 4 + 3];
+    if (cn == 4) out[3] = image_row(src, y)[(size_t)x * 4 + 3];
 }
 
-void* kuwahara_worker(void* arg) {
-    WorkerContext* ctx = (WorkerContext*)arg;
-    
-    for (int y = ctx->start_row; y < ctx->end_row; y++) {
-        for (int x = 0; x < ctx->src->width; x++) {
-            kuwahara_filter_pixel(ctx->src, ctx->dst, ctx->integral, x, y, ctx->radius);
+// KUWAHARA_BLOCK adjacent pixels (x0 .. x0 + KUWAHARA_BLOCK - 1, y) whose
+// quadrants all lie inside the image. No clamping is needed there and every
+// quadrant has area (radius + 1)^2, so the corner offsets are fixed and the
+// SoA planes turn each corner into a contiguous run of loads. All four
+// quadrants are evaluated in one pass with each statement working across the
+// whole block, which the compiler maps onto vector lanes. The arithmetic
+// matches get_region_stats exactly.
+static ALWAYS_INLINE void kuwahara_filter_block(Image* src, Image* dst, IntegralImage* integral,
+                                                int x0, int y, int radius, int cn) {
+    int colors = color_channels(cn);
+    size_t iw = integral->cols + 1;
+    int64_t area = (int64_t)(radius + 1) * (radius + 1);
+    float area_f = (float)area;
+    float area_sq = (float)(area * area);
+
+    // SAT rows above/below and columns left/right of each quadrant (1-based)
+    int ty = y - integral->row0;
+    int tx = x0 - integral->col0;
+    const int top[4] = {ty - radius, ty - radius, ty, ty};
+    const int bottom[4] = {ty + 1, ty + 1, ty + radius + 1, ty + radius + 1};
+    const int left[4] = {tx - radius, tx, tx - radius, tx};
+    const int right[4] = {tx + 1, tx + radius + 1, tx + 1, tx + radius + 1};
+
+    float best_total[KUWAHARA_BLOCK];
+    float best_mean[3][KUWAHARA_BLOCK] = {{0}};
+    for (int i = 0; i < KUWAHARA_BLOCK; i++) best_total[i] = INFINITY;
+
+    for (int q = 0; q < 4; q++) {
+        float total[KUWAHARA_BLOCK] = {0};
+        float mean[3][KUWAHARA_BLOCK];
+
+        for (int ch = 0; ch < colors; ch++) {
+            const uint32_t* plane_sum = integral->sum + ch * integral->plane;
+            const uint32_t* plane_sum_sq = integral->sum_sq + ch * integral->plane;
+            const uint32_t* s_br = plane_sum + bottom[q] * iw + right[q];
+            const uint32_t* s_bl = plane_sum + bottom[q] * iw + left[q];
+            const uint32_t* s_tr = plane_sum + top[q] * iw + right[q];
+            const uint32_t* s_tl = plane_sum + top[q] * iw + left[q];
+            const uint32_t* q_br = plane_sum_sq + bottom[q] * iw + right[q];
+            const uint32_t* q_bl = plane_sum_sq + bottom[q] * iw + left[q];
+            const uint32_t* q_tr = plane_sum_sq + top[q] * iw + right[q];
+            const uint32_t* q_tl = plane_sum_sq + top[q] * iw + left[q];
+
+            for (int i = 0; i < KUWAHARA_BLOCK; i++) {
+                uint32_t sum = s_br[i] - s_bl[i] - s_tr[i] + s_tl[i];
+                uint32_t sum_sq = q_br[i] - q_bl[i] - q_tr[i] + q_tl[i];
+                int64_t spread = area * sum_sq - (int64_t)sum * sum;
+                mean[ch][i] = (float)sum / area_f;
+                total[i] += (float)spread / area_sq;
+            }
+        }
+
+        for (int i = 0; i < KUWAHARA_BLOCK; i++) {
+            int better = total[i] < best_total[i];
+            best_total[i] = better ? total[i] : best_total[i];
+            for (int ch = 0; ch < colors; ch++) {
+                best_mean[ch][i] = better ? mean[ch][i] : best_mean[ch][i];
+            }
         }
     }
-    
-    return NULL;
+
+    unsigned char* out = image_row(dst, y) + (size_t)x0 * cn;
+    const unsigned char* in = image_row(src, y) + (size_t)x0 * cn;
+    for (int i = 0; i < KUWAHARA_BLOCK; i++) {
+        for (int ch = 0; ch < colors; ch++) {
+            out[i * cn + ch] = (unsigned char)fminf(255.0f, fmaxf(0.0f, best_mean[ch][i]));
+        }
+        if (cn == 4) out[i * 4 + 3] = in[i * 4 + 3];
+    }
 }
 
-void apply_kuwahara_filter(Image* src, Image* dst, int radius, int num_workers) {
-    IntegralImage* integral = create_integral_image(src->width, src->height);
-    
-    long start_time = get_time_ms();
-    build_integral_images(src, integral);
-    long sat_time = get_time_ms() - start_time;
-    printf("SAT build time: %ldms\n", sat_time);
-    
-    pthread_t* threads = (pthread_t*)malloc(num_workers * sizeof(pthread_t));
-    WorkerContext* contexts = (WorkerContext*)malloc(num_workers * sizeof(WorkerContext));
-    
-    int rows_per_worker = src->height / num_workers;
-    for (int i = 0; i < num_workers; i++) {
-        contexts[i].src = src;
-        contexts[i].dst = dst;
-        contexts[i].integral = integral;
-        contexts[i].radius = radius;
-        contexts[i].start_row = i * rows_per_worker;
-        contexts[i].end_row = (i == num_workers - 1) ? src->height : (i + 1) * rows_per_worker;
-        
-        pthread_create(&threads[i], NULL, kuwahara_worker, &contexts[i]);
+// Filter columns [x_begin, x_end) of image rows [start_row, end_row), which
+// integral must cover along with their radius halo
+static ALWAYS_INLINE void kuwahara_filter_span_n(Image* src, Image* dst, IntegralImage* integral, int radius,
+                                                  int x_begin, int x_end, int start_row, int end_row, int cn) {
+    int w = src->width;
+    int h = src->height;
+
+    for (int y = start_row; y < end_row; y++) {
+        int x = x_begin;
+
+        // Interior rows: clamped pixels at both ends, unclamped blocks between
+        if (y >= radius && y + radius < h) {
+            for (; x < radius && x < x_end; x++) {
+                kuwahara_filter_pixel(src, dst, integral, x, y, radius, cn);
+            }
+            for (; x + KUWAHARA_BLOCK <= x_end && x + KUWAHARA_BLOCK + radius <= w; x += KUWAHARA_BLOCK) {
+                kuwahara_filter_block(src, dst, integral, x, y, radius, cn);
+            }
+        }
+
+        for (; x < x_end; x++) {
+            kuwahara_filter_pixel(src, dst, integral, x, y, radius, cn);
+        }
     }
-    
-    for (int i = 0; i < num_workers; i++) {
-        pthread_join(threads[i], NULL);
+}
+
+static void kuwahara_filter_span(Image* src, Image* dst, IntegralImage* integral, int radius,
+                                 int x_begin, int x_end, int start_row, int end_row) {
+    CHANNEL_SWITCH(src->channels, kuwahara_filter_span_n, src, dst, integral, radius, x_begin, x_end,
+                   start_row, end_row);
+}
+
+// Filter image rows [start_row, end_row), which integral must cover along
+// with their radius halo
+void kuwahara_filter_rows(Image* src, Image* dst, IntegralImage* integral, int radius,
+                          int start_row, int end_row) {
+    kuwahara_filter_span(src, dst, integral, radius, 0, src->width, start_row, end_row);
+}
+
+void kuwahara_worker(void* arg, int start_row, int end_row, int worker) {
+    (void)worker;
+    WorkerContext* ctx = (WorkerContext*)arg;
+    kuwahara_filter_rows(ctx->src, ctx->dst, ctx->integral, ctx->radius, start_row, end_row);
+}
+
+// Filter rows [start_row, end_row) of src on the calling thread, building
+// integral over just those rows plus the radius halo. integral must have been
+// created for src's width and at least that many rows. Also used by
+// pipeline.c to run Kuwahara on one band of a larger image.
+void kuwahara_filter_band(Image* src, Image* dst, IntegralImage* integral, int radius,
+                          int start_row, int end_row) {
+    int h = src->height;
+    int first = (start_row - radius > 0) ? start_row - radius : 0;
+    int last = (end_row + radius < h) ? end_row + radius : h;
+
+    IntegralContext build = {
+        .src = src,
+        .integral = integral
+    };
+    integral->height = h;
+    integral->row0 = first;
+    integral->rows = last - first;
+    integral_rows_worker(&build, 0, integral->rows, 0);
+    integral_columns_worker(&build, 0, src->width, 0);
+
+    kuwahara_filter_rows(src, dst, integral, radius, start_row, end_row);
+}
+
+// Banded mode: each tile is cut into bands of KUWAHARA_BAND_ROWS output rows.
+// A band builds its own table over its rows plus the radius halo, filters and
+// moves on, reusing one table allocation per tile.
+void kuwahara_banded_worker(void* arg, int start_row, int end_row, int worker) {
+    (void)worker;
+    WorkerContext* ctx = (WorkerContext*)arg;
+    Image* src = ctx->src;
+    int radius = ctx->radius;
+    int h = src->height;
+
+    int band_rows = end_row - start_row;
+    if (band_rows > KUWAHARA_BAND_ROWS) band_rows = KUWAHARA_BAND_ROWS;
+    int max_rows = band_rows + 2 * radius;
+    if (max_rows > h) max_rows = h;
+    IntegralImage* integral = create_integral_image(src->width, h, max_rows, src->channels);
+
+    for (int y0 = start_row; y0 < end_row; y0 += band_rows) {
+        int y1 = (y0 + band_rows < end_row) ? y0 + band_rows : end_row;
+        kuwahara_filter_band(src, ctx->dst, integral, radius, y0, y1);
     }
+
+    free_integral_image(integral);
+}
+
+void apply_kuwahara_filter(Image* src, Image* dst, int radius, KuwaharaMode mode, ThreadPool* pool) {
+    if (radius > KUWAHARA_MAX_RADIUS) {
+        fprintf(stderr, "Kuwahara radius %d clamped to %d\n", radius, KUWAHARA_MAX_RADIUS);
+        radius = KUWAHARA_MAX_RADIUS;
+    }
+
+    WorkerContext ctx = {
+        .src = src,
+        .dst = dst,
+        .radius = radius
+    };
+
+    if (mode == KUWAHARA_BANDED) {
+        thread_pool_set_phase(pool, "sat_and_filter_banded");
+        thread_pool_for(pool, src->height, kuwahara_banded_worker, &ctx);
+        return;
+    }
+
+    // The table build shows up in the profile as the sat_rows and
+    // sat_columns phases
+    IntegralImage* integral = create_integral_image(src->width, src->height, src->height, src->channels);
+    build_integral_images(src, integral, pool);
+
+    ctx.integral = integral;
+    thread_pool_set_phase(pool, "filter");
+    thread_pool_for(pool, src->height, kuwahara_worker, &ctx);
     
-    free(threads);
-    free(contexts);
     free_integral_image(integral);
 }
 
+// Pool loop body for rows of the window of apply_kuwahara_filter_region
+void kuwahara_region_worker(void* arg, int start_row, int end_row, int worker) {
+    (void)worker;
+    WorkerContext* ctx = (WorkerContext*)arg;
+    ImageRect* rect = &ctx->rect;
+    kuwahara_filter_span(ctx->src, ctx->dst, ctx->integral, ctx->radius, rect->x, rect->x + rect->width,
+                         rect->y + start_row, rect->y + end_row);
+}
+
+// Incremental re-filtering after src changed inside dirty: only the pixels
+// whose quadrants reach into dirty, the rectangle grown by radius, are
+// recomputed into dst, the rest of dst is left as it is. The summed-area
+// table covers just that window plus its own radius halo, so the cost
+// follows the size of the edit rather than of the frame. Returns the window
+// that was written, empty when dirty misses the image.
+ImageRect apply_kuwahara_filter_region(Image* src, Image* dst, int radius, ImageRect dirty,
+                                       ThreadPool* pool) {
+    if (radius > KUWAHARA_MAX_RADIUS) {
+        fprintf(stderr, "Kuwahara radius %d clamped to %d\n", radius, KUWAHARA_MAX_RADIUS);
+        radius = KUWAHARA_MAX_RADIUS;
+    }
+
+    ImageRect empty = {0, 0, 0, 0};
+    if (dirty.width <= 0 || dirty.height <= 0) return empty;
+    ImageRect out = clip_rect(dirty, radius, src->width, src->height);
+    if (out.width == 0 || out.height == 0) return out;
+
+    // Table window: the output window plus the pixels its quadrants read
+    ImageRect table = clip_rect(out, radius, src->width, src->height);
+    IntegralImage* integral = create_integral_window(src->width, src->height, table.width, table.height,
+                                                     color_channels(src->channels));
+    integral->col0 = table.x;
+    integral->row0 = table.y;
+    build_integral_images(src, integral, pool);
+
+    WorkerContext ctx = {
+        .src = src,
+        .dst = dst,
+        .integral = integral,
+        .radius = radius,
+        .rect = out
+    };
+    thread_pool_set_phase(pool, "filter");
+    thread_pool_for(pool, out.height, kuwahara_region_worker, &ctx);
+
+    free_integral_image(integral);
+    return out;
+}
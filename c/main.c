@@ -1,93 +1,328 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 
-#define STB_IMAGE_IMPLEMENTATION
-#include "../stb/stb_image.h"
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "../stb/stb_image_write.h"
+#include "filter.h"
 
-typedef struct {
-    unsigned char* data;
-    int width;
-    int height;
-    int channels;
-} Image;
-
-// External filter functions
-void gaussian_blur(Image* src, Image* dst, int radius, int num_workers);
-void apply_kuwahara_filter(Image* src, Image* dst, int radius, int num_workers);
-void monte_carlo_operation(int total_samples, int num_workers);
-
-Image* load_image(const char* filename) {
-    int width, height, channels;
-    unsigned char* data = stbi_load(filename, &width, &height, &channels, 4);
-    if (!data) {
-        return NULL;
-    }
-
-    Image* img = (Image*)malloc(sizeof(Image));
-    img->width = width;
-    img->height = height;
-    img->channels = 4;
-    img->data = data;
-
-    return img;
-}
+// External functions from batch.c
+int run_batch(const char* operation, const char* input, const char* output_dir,
+              const char* arg, float sigma, int png_level, PngFilter png_filter, ThreadPool* pool);
+int run_stream(const char* operation, const char* size, const char* arg, float sigma, ThreadPool* pool);
 
-int save_image(const char* filename, Image* img) {
-    return stbi_write_png(filename, img->width, img->height, img->channels,
-                         img->data, img->width * img->channels);
-}
+// External functions from image.c
+long get_time_ms();
+int has_extension(const char* filename, const char* ext);
+
+// Run one filter operation from src into dst, with the radius argument (or
+// pipeline spec) as given on the command line. sigma is the blurs' Gaussian
+// sigma, 0 for the default of radius / 3. Returns 0 for an unknown operation
+// or invalid argument.
+int apply_operation(const char* operation, const char* arg, float sigma, Image* src, Image* dst,
+                    ThreadPool* pool, int verbose) {
+    int radius = atoi(arg);
+    int num_workers = thread_pool_size(pool);
+    if (sigma <= 0.0f) sigma = gaussian_default_sigma(radius);
 
-void free_image(Image* img) {
-    if (img) {
-        if (img->data) {
-            stbi_image_free(img->data);
+    if (strcmp(operation, "blur") == 0) {
+        if (verbose) printf("Applying Gaussian blur with radius %d using %d workers\n", radius, num_workers);
+        gaussian_blur_sigma(src, dst, radius, sigma, BLUR_TRANSPOSE, pool);
+    } else if (strcmp(operation, "blur_fused") == 0) {
+        if (verbose) printf("Applying fused Gaussian blur with radius %d using %d workers\n", radius, num_workers);
+        gaussian_blur_sigma(src, dst, radius, sigma, BLUR_FUSED, pool);
+    } else if (strcmp(operation, "blur_fixed") == 0) {
+        if (verbose) printf("Applying fixed-point Gaussian blur with radius %d using %d workers\n", radius, num_workers);
+        gaussian_blur_sigma(src, dst, radius, sigma, BLUR_FIXED, pool);
+    } else if (strcmp(operation, "blur_box") == 0) {
+        if (verbose) printf("Applying box-approximated Gaussian blur with radius %d using %d workers\n", radius, num_workers);
+        gaussian_blur_sigma(src, dst, radius, sigma, BLUR_BOX, pool);
+    } else if (strcmp(operation, "blur_tiled") == 0) {
+        if (verbose) printf("Applying tiled Gaussian blur with radius %d using %d workers\n", radius, num_workers);
+        gaussian_blur_sigma(src, dst, radius, sigma, BLUR_TILED, pool);
+    } else if (strcmp(operation, "blur_graph") == 0) {
+        if (verbose) printf("Applying task-graph Gaussian blur with radius %d using %d workers\n", radius, num_workers);
+        gaussian_blur_sigma(src, dst, radius, sigma, BLUR_GRAPH, pool);
+    } else if (strcmp(operation, "kuwahara") == 0) {
+        if (verbose) printf("Applying Kuwahara filter with radius %d using %d workers\n", radius, num_workers);
+        apply_kuwahara_filter(src, dst, radius, KUWAHARA_FULL_SAT, pool);
+    } else if (strcmp(operation, "kuwahara_banded") == 0) {
+        if (verbose) printf("Applying banded Kuwahara filter with radius %d using %d workers\n", radius, num_workers);
+        apply_kuwahara_filter(src, dst, radius, KUWAHARA_BANDED, pool);
+    } else if (strcmp(operation, "kuwahara_generalized") == 0) {
+        if (verbose) printf("Applying generalized Kuwahara filter with radius %d using %d workers\n", radius, num_workers);
+        apply_generalized_kuwahara(src, dst, radius, pool);
+    } else if (strcmp(operation, "pipeline") == 0) {
+        if (verbose) printf("Applying pipeline %s using %d workers\n", arg, num_workers);
+        PipelineStats stats;
+        if (!run_pipeline(src, dst, arg, &stats, pool)) return 0;
+        for (int k = 0; verbose && k < stats.num_stages; k++) {
+            printf("Stage %d (%s) time: %ldms (summed over workers)\n", k + 1, stats.names[k],
+                   stats.stage_ns[k] / 1000000);
         }
-        free(img);
+    } else {
+        fprintf(stderr, "Unknown operation: %s. Use 'blur', 'blur_fused', 'blur_fixed', 'blur_box', "
+                "'blur_tiled', 'blur_graph', 'kuwahara', 'kuwahara_banded', 'kuwahara_generalized', "
+                "'pipeline', or 'monte_carlo'\n", operation);
+        return 0;
     }
+    return 1;
 }
 
-long get_time_ms() {
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+// Re-filter only the pixels of dst that a change of src inside dirty affects.
+// blur and blur_fused share a region entry point since their output is the
+// same, as do the Kuwahara modes. sigma is as for apply_operation. Returns 0
+// for any other operation.
+static int apply_operation_region(const char* operation, const char* arg, float sigma, Image* src,
+                                  Image* dst, ImageRect dirty, ThreadPool* pool) {
+    int radius = atoi(arg);
+    if (sigma <= 0.0f) sigma = gaussian_default_sigma(radius);
+    ImageRect done;
+
+    if (strcmp(operation, "blur") == 0 || strcmp(operation, "blur_fused") == 0) {
+        done = gaussian_blur_region(src, dst, radius, sigma, dirty, pool);
+    } else if (strcmp(operation, "kuwahara") == 0 || strcmp(operation, "kuwahara_banded") == 0) {
+        done = apply_kuwahara_filter_region(src, dst, radius, dirty, pool);
+    } else {
+        fprintf(stderr, "Operation %s has no region mode, use 'blur' or 'kuwahara'\n", operation);
+        return 0;
+    }
+    printf("Recomputed %dx%d pixels at (%d, %d)\n", done.width, done.height, done.x, done.y);
+    return 1;
+}
+
+static const char* rng_names[] = {"lcg", "splitmix", "lcg8"};
+
+// Running estimate of a progressive Monte Carlo run
+static void print_monte_carlo_progress(void* arg, long elapsed_ms, MonteCarloResult progress) {
+    (void)arg;
+    printf("  %ldms: %ld samples, estimate %.6f +/- %.6f\n", elapsed_ms, progress.samples,
+           progress.estimate, progress.standard_error);
+}
+
+static void print_monte_carlo_result(MonteCarloResult result, int progressive) {
+    if (progressive) printf("Stopped on: %s\n", result.stop_reason);
+    printf("Total samples: %ld\n", result.samples);
+    printf("Points inside circle: %ld\n", result.inside);
+    if (result.samples > 0) {
+        printf("Pi estimate: %.6f\n", result.estimate);
+        if (progressive) printf("Standard error: %.6f\n", result.standard_error);
+        printf("Error: %.6f\n", 3.141592653589793 - result.estimate);
+    }
 }
 
 void print_usage(const char* program) {
-    fprintf(stderr, "Usage: %s <operation> <input_image> <output_image> <radius> <workers>\n", program);
-    fprintf(stderr, "  operation: 'blur', 'kuwahara', or 'monte_carlo'\n");
+    fprintf(stderr, "Usage: %s <operation> <input_image> <output_image> <radius> <workers> [options]\n", program);
+    fprintf(stderr, "       %s stream <operation> <width>x<height>[x<channels>] <radius> <workers> [options]\n",
+            program);
+    fprintf(stderr, "  operation: 'blur', 'blur_fused', 'blur_fixed', 'blur_box', "
+                     "'blur_tiled', 'blur_graph', 'kuwahara', 'kuwahara_banded', 'kuwahara_generalized', 'pipeline', "
+                     "or 'monte_carlo'\n");
+    fprintf(stderr, "  blur_fused: vertical pass without transposing the image\n");
+    fprintf(stderr, "  blur_fixed: 'blur' with 16-bit fixed-point weights instead of floats\n");
+    fprintf(stderr, "  blur_box: 3 box blurs approximating the Gaussian, cost independent of radius\n");
+    fprintf(stderr, "  blur_tiled: both passes per cache-sized band of rows, no full-frame temporary\n");
+    fprintf(stderr, "  blur_graph: 'blur_fused' without a barrier, each strip's vertical pass starts\n");
+    fprintf(stderr, "              once the horizontal strips under its halo are done\n");
+    fprintf(stderr, "  kuwahara_banded: per-band summed-area tables, memory bounded by band size\n");
+    fprintf(stderr, "  kuwahara_generalized: 8 smooth sectors blended by variance (Papari et al.)\n");
+    fprintf(stderr, "  pipeline: chain of filters run band by band, e.g. 'blur:5,kuwahara:4';\n");
+    fprintf(stderr, "            'blur:5/2.5' gives a blur stage sigma 2.5 (default: radius / 3)\n");
+    fprintf(stderr, "  For pipeline: radius is the filter chain\n");
     fprintf(stderr, "  For monte_carlo: radius represents number of samples\n");
+    fprintf(stderr, "  stream: filter raw frames (RGBA unless channels is 1 or 3) from stdin to stdout,\n");
+    fprintf(stderr, "          e.g. ffmpeg -i in.mp4 -f rawvideo -pix_fmt rgba - | %s stream blur 1920x1080 5 8\n",
+            program);
+    fprintf(stderr, "  Images named *.pam are 8-bit gray, RGB or RGBA PAM files, mapped on load and written raw\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  --grain=<rows>  rows per scheduler tile (default: automatic)\n");
+    fprintf(stderr, "  --sigma=<s>     Gaussian sigma of the blur operations (default: radius / 3)\n");
+    fprintf(stderr, "  --batch         input is a directory or a file listing one image per line,\n");
+    fprintf(stderr, "                  output is a directory; decode, filter and encode overlap\n");
+    fprintf(stderr, "  --affinity=<none|compact|scatter>\n");
+    fprintf(stderr, "                  pin workers, filling one socket first or round-robin over sockets\n");
+    fprintf(stderr, "  --rng=<lcg|splitmix|lcg8>  Monte Carlo generator: the cross-language LCG (default),\n");
+    fprintf(stderr, "                  counter-based SplitMix64, or 8 interleaved LCG streams\n");
+    fprintf(stderr, "  --target-error=<e>  Monte Carlo stops once the standard error is below e;\n");
+    fprintf(stderr, "                  the sample count becomes a cap (0: none)\n");
+    fprintf(stderr, "  --deadline=<ms>   Monte Carlo stops after ms milliseconds, same as above\n");
+    fprintf(stderr, "  --profile=<file>  write per-phase wall time and per-worker busy/idle time as JSON\n");
+    fprintf(stderr, "  --perf-counters   add cycles and LLC misses per worker to the profile\n");
+    fprintf(stderr, "  --huge-pages    back filter scratch buffers with transparent huge pages\n");
+    fprintf(stderr, "  --roi=<x,y,w,h>   re-filter only the pixels a change inside this rectangle\n");
+    fprintf(stderr, "                  affects (blur and kuwahara), the rest is copied from the input\n");
+    fprintf(stderr, "  --png-level=<0-9>  zlib level of the output PNG (default: 4)\n");
+    fprintf(stderr, "  --png-filter=<none|sub|up|average|paeth|adaptive>\n");
+    fprintf(stderr, "                  PNG row filter, adaptive picks one per row (default)\n");
+}
+
+typedef struct {
+    int grain;
+    float sigma;  // 0 for the default sigma
+    int batch;
+    int huge_pages;
+    PoolAffinity affinity;
+    const char* profile;  // JSON output path, NULL when not profiling
+    int perf_counters;
+    MonteCarloRng rng;
+    double target_error;  // Progressive Monte Carlo when this or deadline_ms is set
+    long deadline_ms;
+    int has_roi;
+    ImageRect roi;  // Dirty rectangle, see --roi
+    int png_level;
+    PngFilter png_filter;
+} Options;
+
+static int parse_png_filter(const char* name, PngFilter* filter) {
+    const char* names[] = {"none", "sub", "up", "average", "paeth", "adaptive"};
+    for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++) {
+        if (strcmp(name, names[i]) == 0) {
+            *filter = (PngFilter)i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Parse trailing --name=value options, returns 0 on an unknown option
+int parse_options(int argc, char* argv[], Options* opts) {
+    for (int i = 0; i < argc; i++) {
+        if (strncmp(argv[i], "--grain=", 8) == 0) {
+            opts->grain = atoi(argv[i] + 8);
+        } else if (strncmp(argv[i], "--sigma=", 8) == 0) {
+            opts->sigma = (float)atof(argv[i] + 8);
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            opts->batch = 1;
+        } else if (strncmp(argv[i], "--profile=", 10) == 0) {
+            opts->profile = argv[i] + 10;
+        } else if (strcmp(argv[i], "--rng=lcg") == 0) {
+            opts->rng = MC_RNG_LCG;
+        } else if (strcmp(argv[i], "--rng=splitmix") == 0) {
+            opts->rng = MC_RNG_SPLITMIX;
+        } else if (strcmp(argv[i], "--rng=lcg8") == 0) {
+            opts->rng = MC_RNG_LCG8;
+        } else if (strncmp(argv[i], "--target-error=", 15) == 0) {
+            opts->target_error = atof(argv[i] + 15);
+        } else if (strncmp(argv[i], "--deadline=", 11) == 0) {
+            opts->deadline_ms = strtol(argv[i] + 11, NULL, 10);
+        } else if (strncmp(argv[i], "--roi=", 6) == 0) {
+            ImageRect* roi = &opts->roi;
+            if (sscanf(argv[i] + 6, "%d,%d,%d,%d", &roi->x, &roi->y, &roi->width, &roi->height) != 4) {
+                fprintf(stderr, "Invalid region: %s\n", argv[i] + 6);
+                return 0;
+            }
+            opts->has_roi = 1;
+        } else if (strcmp(argv[i], "--perf-counters") == 0) {
+            opts->perf_counters = 1;
+        } else if (strcmp(argv[i], "--huge-pages") == 0) {
+            opts->huge_pages = 1;
+        } else if (strcmp(argv[i], "--affinity=none") == 0) {
+            opts->affinity = POOL_AFFINITY_NONE;
+        } else if (strcmp(argv[i], "--affinity=compact") == 0) {
+            opts->affinity = POOL_AFFINITY_COMPACT;
+        } else if (strcmp(argv[i], "--affinity=scatter") == 0) {
+            opts->affinity = POOL_AFFINITY_SCATTER;
+        } else if (strncmp(argv[i], "--png-level=", 12) == 0) {
+            opts->png_level = atoi(argv[i] + 12);
+        } else if (strncmp(argv[i], "--png-filter=", 13) == 0) {
+            if (!parse_png_filter(argv[i] + 13, &opts->png_filter)) {
+                fprintf(stderr, "Unknown PNG filter: %s\n", argv[i] + 13);
+                return 0;
+            }
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Write the profile, if one was asked for, before the pool goes away
+static void finish_profile(ThreadPool* pool, const Options* opts) {
+    if (opts->profile && !thread_pool_write_profile(pool, opts->profile)) {
+        fprintf(stderr, "Failed to write profile: %s\n", opts->profile);
+    }
 }
 
 int main(int argc, char* argv[]) {
-    if (argc != 6) {
+    Options opts = {
+        .png_level = 4,
+        .png_filter = PNG_FILTER_ADAPTIVE
+    };
+    if (argc < 6 || !parse_options(argc - 6, argv + 6, &opts)) {
         print_usage(argv[0]);
         return 1;
     }
-
     const char* operation = argv[1];
+    // Only the blurs have a sigma, pipeline stages take theirs in the spec
+    const char* filter = strcmp(operation, "stream") == 0 ? argv[2] : operation;
+    if (opts.sigma > 0.0f && strncmp(filter, "blur", 4) != 0) {
+        fprintf(stderr, "--sigma applies to the blur operations only, not %s%s\n", filter,
+                strcmp(filter, "pipeline") == 0 ? " (use blur:<radius>/<sigma> stages)" : "");
+        return 1;
+    }
+
     const char* input_path = argv[2];
     const char* output_path = argv[3];
-    int radius = atoi(argv[4]);
     int num_workers = atoi(argv[5]);
+    if (num_workers <= 0) num_workers = 1;
+
+    // Workers are created once and parked between filter passes
+    ThreadPool* pool = thread_pool_create(num_workers);
+    thread_pool_set_grain(pool, opts.grain);
+    thread_pool_set_huge_pages(pool, opts.huge_pages);
+    if (!thread_pool_set_affinity(pool, opts.affinity)) {
+        fprintf(stderr, "Warning: could not pin workers to CPUs\n");
+    }
+    if (opts.profile) {
+        thread_pool_enable_profile(pool, opts.perf_counters);
+    }
+
+    if (strcmp(operation, "stream") == 0) {
+        int ok = run_stream(argv[2], argv[3], argv[4], opts.sigma, pool);
+        finish_profile(pool, &opts);
+        thread_pool_destroy(pool);
+        return ok ? 0 : 1;
+    }
 
     if (strcmp(operation, "monte_carlo") == 0) {
-        int samples = radius;
-        printf("Monte Carlo Pi estimation with %d samples using %d workers\n", samples, num_workers);
+        // Parsed as 64-bit, runs beyond 2^31 samples are common
+        long samples = strtol(argv[4], NULL, 10);
+        int progressive = opts.target_error > 0 || opts.deadline_ms > 0;
+        if (progressive) {
+            printf("Monte Carlo Pi estimation capped at %ld samples using %d workers\n", samples, num_workers);
+        } else {
+            printf("Monte Carlo Pi estimation with %ld samples using %d workers\n", samples, num_workers);
+        }
         long start_time = get_time_ms();
-        monte_carlo_operation(samples, num_workers);
+        MonteCarloResult result;
+        if (progressive) {
+            printf("Progressive Monte Carlo Pi Estimation (%s)\n", rng_names[opts.rng]);
+            result = monte_carlo_progressive(samples, opts.target_error, opts.deadline_ms, opts.rng,
+                                             print_monte_carlo_progress, NULL, pool);
+        } else {
+            printf("Monte Carlo Pi Estimation (%s)\n", rng_names[opts.rng]);
+            result = monte_carlo_operation(samples, opts.rng, pool);
+        }
         long elapsed = get_time_ms() - start_time;
+        print_monte_carlo_result(result, progressive);
         printf("Time: %ldms\n", elapsed);
+        finish_profile(pool, &opts);
+        thread_pool_destroy(pool);
         return 0;
     }
 
+    if (opts.batch) {
+        int ok = run_batch(operation, input_path, output_path, argv[4], opts.sigma, opts.png_level,
+                           opts.png_filter, pool);
+        finish_profile(pool, &opts);
+        thread_pool_destroy(pool);
+        return ok ? 0 : 1;
+    }
+
     long start_time = get_time_ms();
     Image* src = load_image(input_path);
     if (!src) {
         fprintf(stderr, "Failed to load image: %s\n", input_path);
+        thread_pool_destroy(pool);
         return 1;
     }
     long load_time = get_time_ms() - start_time;
@@ -99,20 +334,26 @@ int main(int argc, char* argv[]) {
     dst->width = src->width;
     dst->height = src->height;
     dst->channels = src->channels;
-    dst->data = (unsigned char*)malloc(src->width * src->height * 4);
+    dst->stride = (size_t)src->width * src->channels;
+    size_t frame_bytes = (size_t)src->width * src->height * src->channels;
+    dst->data = (unsigned char*)malloc(frame_bytes);
+    // Let the workers that write each strip place its pages
+    thread_pool_first_touch(pool, dst->data, frame_bytes);
+
+    // A region run starts from the input and updates just the affected pixels
+    if (opts.has_roi) {
+        memcpy(dst->data, src->data, frame_bytes);
+    }
 
     start_time = get_time_ms();
-    if (strcmp(operation, "blur") == 0) {
-        printf("Applying Gaussian blur with radius %d using %d workers\n", radius, num_workers);
-        gaussian_blur(src, dst, radius, num_workers);
-    } else if (strcmp(operation, "kuwahara") == 0) {
-        printf("Applying Kuwahara filter with radius %d using %d workers\n", radius, num_workers);
-        apply_kuwahara_filter(src, dst, radius, num_workers);
-    } else {
-        fprintf(stderr, "Unknown operation: %s. Use 'blur', 'kuwahara', or 'monte_carlo'\n", operation);
+    int ok = opts.has_roi
+        ? apply_operation_region(operation, argv[4], opts.sigma, src, dst, opts.roi, pool)
+        : apply_operation(operation, argv[4], opts.sigma, src, dst, pool, 1);
+    if (!ok) {
         free_image(src);
         free(dst->data);
         free(dst);
+        thread_pool_destroy(pool);
         return 1;
     }
     long filter_time = get_time_ms() - start_time;
@@ -120,11 +361,15 @@ int main(int argc, char* argv[]) {
     printf("Filter time: %ldms\n", filter_time);
 
     start_time = get_time_ms();
-    if (!save_image(output_path, dst)) {
+    int saved = has_extension(output_path, ".pam")
+        ? save_image(output_path, dst)
+        : save_png(output_path, dst, opts.png_level, opts.png_filter, pool);
+    if (!saved) {
         fprintf(stderr, "Failed to save image: %s\n", output_path);
         free_image(src);
         free(dst->data);
         free(dst);
+        thread_pool_destroy(pool);
         return 1;
     }
     long save_time = get_time_ms() - start_time;
@@ -135,6 +380,8 @@ int main(int argc, char* argv[]) {
     free_image(src);
     free(dst->data);
     free(dst);
+    finish_profile(pool, &opts);
+    thread_pool_destroy(pool);
 
     return 0;
 }
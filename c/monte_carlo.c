@@ -1,43 +1,185 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <pthread.h>
+#include <limits.h>
+#include <stdint.h>
+#include <math.h>
+#include <stdatomic.h>
 #include <time.h>
 
+#include "filter.h"
+
+// Interleaved streams of MC_RNG_LCG8
+#define MC_LANES 8
+
+// Samples per batch of the progressive mode. Workers publish their counts
+// after every batch, so this bounds how stale the running estimate is and how
+// long workers run on after the coordinator asks them to stop.
+#define MC_BATCH_SAMPLES (1L << 18)
+
+// How often the progressive coordinator checks the estimate, and how often it
+// passes it to the progress callback
+#define MC_POLL_MS 10
+#define MC_REPORT_MS 250
+
+// Coordinates are 31-bit integers in [0, MC_COORD_MAX]. A point is inside
+// when x^2 + y^2 <= MC_COORD_MAX^2, which is the LCG mode's floating-point
+// test scaled by MC_COORD_MAX^2 and fits in 63 bits.
+#define MC_COORD_MAX 0x7FFFFFFFu
+
+// Per-worker slot, one cache line each so neighbouring workers never share a
+// line. Workers count in locals and store inside once at the end.
 typedef struct {
-    int samples;
+    long samples;
+    long first_sample;  // Global index of the first sample, for MC_RNG_SPLITMIX
+    long inside;
     unsigned int seed;
-    int inside;
+    MonteCarloRng rng;
+    char pad[64 - 3 * sizeof(long) - sizeof(unsigned int) - sizeof(MonteCarloRng)];
 } ThreadData;
 
+// Per-worker running totals of the progressive mode. Only the owning worker
+// stores to them; the coordinator reads them while the workers run.
+typedef struct {
+    _Atomic long samples;
+    _Atomic long inside;
+    char pad[64 - 2 * sizeof(long)];
+} ProgressSlot;
+
+// Shared state of one progressive run. Batches are claimed from a global
+// counter, so batch b always covers the same samples whichever worker runs it.
+typedef struct {
+    ProgressSlot* slots;
+    MonteCarloRng rng;
+    long max_samples;
+    _Atomic long next_batch;
+    _Atomic int stop;
+} ProgressiveRun;
+
+typedef void (*PoolTaskFn)(void* arg, int worker);
+
+// External functions from thread_pool.c
+void thread_pool_run(ThreadPool* pool, PoolTaskFn task, void* arg);
+void thread_pool_begin(ThreadPool* pool, PoolTaskFn task, void* arg);
+void thread_pool_wait(ThreadPool* pool);
+void thread_pool_set_phase(ThreadPool* pool, const char* name);
+
+// External functions from image.c
+long get_time_ms();
+
 // Linear Congruential Generator - same formula across all languages
 double lcg_random(unsigned int* seed) {
     *seed = *seed * 1664525u + 1013904223u;
     return (double)(*seed & 0x7FFFFFFFu) / (double)0x7FFFFFFFu;
 }
 
-void* monte_carlo_worker(void* arg) {
-    ThreadData* data = (ThreadData*)arg;
-    data->inside = 0;
-    
-    for (int i = 0; i < data->samples; i++) {
-        double x = lcg_random(&data->seed);
-        double y = lcg_random(&data->seed);
+static int inside_circle(uint32_t x, uint32_t y) {
+    return (uint64_t)x * x + (uint64_t)y * y <= (uint64_t)MC_COORD_MAX * MC_COORD_MAX;
+}
+
+// SplitMix64 finalizer of a counter: sample i is a pure function of i, so
+// iterations are independent and the result does not depend on how samples
+// are split between workers
+static uint64_t splitmix64(uint64_t counter) {
+    uint64_t z = counter * 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static long count_splitmix(long first, long samples) {
+    long inside = 0;
+    for (long i = 0; i < samples; i++) {
+        uint64_t bits = splitmix64((uint64_t)(first + i));
+        inside += inside_circle((uint32_t)(bits >> 33), (uint32_t)bits & MC_COORD_MAX);
+    }
+    return inside;
+}
+
+// MC_LANES independent LCG streams advanced in lockstep. The lane loops have
+// no cross-lane dependency, so the compiler keeps the states in one vector
+// register (AVX2: 8 x 32-bit) and the chain latency is paid once per
+// MC_LANES samples.
+static long count_lcg8(unsigned int seed, long samples) {
+    uint32_t state[MC_LANES];
+    uint64_t inside[MC_LANES] = {0};
+    for (int lane = 0; lane < MC_LANES; lane++) {
+        state[lane] = seed + lane * 0x9E3779B9u;
+    }
+
+    long blocks = samples / MC_LANES;
+    for (long b = 0; b < blocks; b++) {
+        for (int lane = 0; lane < MC_LANES; lane++) {
+            uint32_t x = state[lane] * 1664525u + 1013904223u;
+            uint32_t y = x * 1664525u + 1013904223u;
+            state[lane] = y;
+            inside[lane] += inside_circle(x & MC_COORD_MAX, y & MC_COORD_MAX);
+        }
+    }
+
+    long total = 0;
+    for (int lane = 0; lane < MC_LANES; lane++) {
+        total += (long)inside[lane];
+    }
+    // Leftover samples from the first stream
+    for (long i = blocks * MC_LANES; i < samples; i++) {
+        uint32_t x = state[0] * 1664525u + 1013904223u;
+        uint32_t y = x * 1664525u + 1013904223u;
+        state[0] = y;
+        total += inside_circle(x & MC_COORD_MAX, y & MC_COORD_MAX);
+    }
+    return total;
+}
+
+static long count_lcg(unsigned int seed, long samples) {
+    long inside = 0;
+    for (long i = 0; i < samples; i++) {
+        double x = lcg_random(&seed);
+        double y = lcg_random(&seed);
         if (x * x + y * y <= 1.0) {
-            data->inside++;
+            inside++;
         }
     }
-    
-    return NULL;
+    return inside;
+}
+
+void monte_carlo_worker(void* arg, int worker) {
+    ThreadData* data = &((ThreadData*)arg)[worker];
+    long inside;
+
+    if (data->rng == MC_RNG_SPLITMIX) {
+        inside = count_splitmix(data->first_sample, data->samples);
+    } else if (data->rng == MC_RNG_LCG8) {
+        inside = count_lcg8(data->seed, data->samples);
+    } else {
+        inside = count_lcg(data->seed, data->samples);
+    }
+    data->inside = inside;
 }
 
-void monte_carlo_operation(int total_samples, int num_workers) {
-    if (num_workers <= 0) num_workers = 1;
+// Standard error of 4 * inside / samples, the binomial error of the hit rate
+static double pi_standard_error(long inside, long samples) {
+    double p = (double)inside / samples;
+    return 4.0 * sqrt(p * (1.0 - p) / samples);
+}
+
+static MonteCarloResult monte_carlo_result(long inside, long samples, const char* stop_reason) {
+    MonteCarloResult result = {
+        .samples = samples,
+        .inside = inside,
+        .estimate = samples > 0 ? 4.0 * inside / samples : 0.0,
+        .standard_error = samples > 0 ? pi_standard_error(inside, samples) : 0.0,
+        .stop_reason = stop_reason
+    };
+    return result;
+}
+
+MonteCarloResult monte_carlo_operation(long total_samples, MonteCarloRng rng, ThreadPool* pool) {
+    int num_workers = thread_pool_size(pool);
     
-    pthread_t* threads = malloc(num_workers * sizeof(pthread_t));
-    ThreadData* thread_data = malloc(num_workers * sizeof(ThreadData));
+    ThreadData* thread_data = aligned_alloc(64, num_workers * sizeof(ThreadData));
     
-    int samples_per_worker = total_samples / num_workers;
-    int remainder = total_samples % num_workers;
+    long samples_per_worker = total_samples / num_workers;
+    long remainder = total_samples % num_workers;
     
     for (int i = 0; i < num_workers; i++) {
         thread_data[i].samples = samples_per_worker;
@@ -45,24 +187,123 @@ void monte_carlo_operation(int total_samples, int num_workers) {
             thread_data[i].samples += remainder;
         }
         thread_data[i].seed = 12345 + i * 67890;  // Consistent seed pattern
-        
-        pthread_create(&threads[i], NULL, monte_carlo_worker, &thread_data[i]);
+        thread_data[i].first_sample = i * samples_per_worker;
+        thread_data[i].rng = rng;
     }
     
-    int total_inside = 0;
+    thread_pool_set_phase(pool, "monte_carlo");
+    thread_pool_run(pool, monte_carlo_worker, thread_data);
+    
+    long total_inside = 0;
     for (int i = 0; i < num_workers; i++) {
-        pthread_join(threads[i], NULL);
         total_inside += thread_data[i].inside;
     }
     
-    double pi_estimate = 4.0 * total_inside / total_samples;
-    
-    printf("Monte Carlo Pi Estimation\n");
-    printf("Total samples: %d\n", total_samples);
-    printf("Points inside circle: %d\n", total_inside);
-    printf("Pi estimate: %.6f\n", pi_estimate);
-    printf("Error: %.6f\n", 3.141592653589793 - pi_estimate);
-    
-    free(threads);
     free(thread_data);
-}
\ No newline at end of file
+    return monte_carlo_result(total_inside, total_samples, NULL);
+}
+// Progressive worker: claim batches until the cap is reached or the
+// coordinator raises stop, publishing the running totals after each one
+static void progressive_worker(void* arg, int worker) {
+    ProgressiveRun* run = (ProgressiveRun*)arg;
+    ProgressSlot* slot = &run->slots[worker];
+    long samples = 0;
+    long inside = 0;
+
+    while (!atomic_load_explicit(&run->stop, memory_order_relaxed)) {
+        long batch = atomic_fetch_add_explicit(&run->next_batch, 1, memory_order_relaxed);
+        long first = batch * MC_BATCH_SAMPLES;
+        if (first >= run->max_samples) break;
+        long count = run->max_samples - first < MC_BATCH_SAMPLES ? run->max_samples - first
+                                                                 : MC_BATCH_SAMPLES;
+
+        // Same seed pattern as the fixed-count mode, one chain per batch
+        unsigned int seed = 12345 + (unsigned int)batch * 67890u;
+        if (run->rng == MC_RNG_SPLITMIX) {
+            inside += count_splitmix(first, count);
+        } else if (run->rng == MC_RNG_LCG8) {
+            inside += count_lcg8(seed, count);
+        } else {
+            inside += count_lcg(seed, count);
+        }
+        samples += count;
+
+        atomic_store_explicit(&slot->inside, inside, memory_order_relaxed);
+        atomic_store_explicit(&slot->samples, samples, memory_order_release);
+    }
+}
+
+// Anytime estimation: run until the standard error drops to target_error,
+// deadline_ms passes or max_samples are drawn, whichever comes first. A zero
+// target, deadline or cap disables that condition. The calling thread
+// coordinates, periodically summing the workers' published counts and
+// handing them to progress every MC_REPORT_MS.
+MonteCarloResult monte_carlo_progressive(long max_samples, double target_error, long deadline_ms,
+                                         MonteCarloRng rng, MonteCarloProgressFn progress,
+                                         void* progress_arg, ThreadPool* pool) {
+    int num_workers = thread_pool_size(pool);
+    ProgressSlot* slots = aligned_alloc(64, num_workers * sizeof(ProgressSlot));
+    for (int i = 0; i < num_workers; i++) {
+        atomic_init(&slots[i].samples, 0);
+        atomic_init(&slots[i].inside, 0);
+    }
+
+    ProgressiveRun run = {
+        .slots = slots,
+        .rng = rng,
+        .max_samples = max_samples > 0 ? max_samples : LONG_MAX - MC_BATCH_SAMPLES
+    };
+    atomic_init(&run.next_batch, 0);
+    atomic_init(&run.stop, 0);
+
+    long start = get_time_ms();
+    long last_report = start;
+    const char* reason = "sample cap";
+
+    thread_pool_set_phase(pool, "monte_carlo");
+    thread_pool_begin(pool, progressive_worker, &run);
+
+    struct timespec poll = {0, MC_POLL_MS * 1000000L};
+    for (;;) {
+        nanosleep(&poll, NULL);
+
+        long samples = 0;
+        long inside = 0;
+        for (int i = 0; i < num_workers; i++) {
+            samples += atomic_load_explicit(&slots[i].samples, memory_order_acquire);
+            inside += atomic_load_explicit(&slots[i].inside, memory_order_relaxed);
+        }
+        if (samples >= run.max_samples) break;
+
+        long now = get_time_ms();
+        if (samples > 0) {
+            double error = pi_standard_error(inside, samples);
+            if (progress && now - last_report >= MC_REPORT_MS) {
+                progress(progress_arg, now - start, monte_carlo_result(inside, samples, NULL));
+                last_report = now;
+            }
+            if (target_error > 0 && error <= target_error) {
+                reason = "target error";
+                break;
+            }
+        }
+        if (deadline_ms > 0 && now - start >= deadline_ms) {
+            reason = "deadline";
+            break;
+        }
+    }
+
+    // Workers finish the batch in hand, so the final totals are exact
+    atomic_store(&run.stop, 1);
+    thread_pool_wait(pool);
+
+    long total_samples = 0;
+    long total_inside = 0;
+    for (int i = 0; i < num_workers; i++) {
+        total_samples += atomic_load(&slots[i].samples);
+        total_inside += atomic_load(&slots[i].inside);
+    }
+
+    free(slots);
+    return monte_carlo_result(total_inside, total_samples, reason);
+}
@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "filter.h"
+
+typedef struct IntegralImage IntegralImage;
+typedef void (*PoolRangeFn)(void* arg, int begin, int end, int worker);
+
+// External functions from thread_pool.c
+void thread_pool_for(ThreadPool* pool, int count, PoolRangeFn body, void* arg);
+void thread_pool_set_phase(ThreadPool* pool, const char* name);
+
+// External functions from blur.c
+float* gaussian_kernel_acquire(int radius, float sigma);
+void gaussian_kernel_release(float* kernel);
+void gaussian_blur_rows(Image* src, Image* dst, Image* scratch, float* kernel, int radius,
+                        int start_row, int end_row);
+
+// External functions from kuwahara.c
+IntegralImage* create_integral_image(int width, int height, int rows, int channels);
+void free_integral_image(IntegralImage* img);
+void kuwahara_filter_band(Image* src, Image* dst, IntegralImage* integral, int radius,
+                          int start_row, int end_row);
+
+// Output rows produced per band. Bands are sized so a band's intermediates
+// (rows times stride, plus halos) stay in L2.
+#define PIPELINE_BAND_ROWS 32
+
+typedef enum {
+    STAGE_BLUR,
+    STAGE_KUWAHARA
+} StageKind;
+
+typedef struct {
+    StageKind kind;
+    int radius;
+    float sigma;    // STAGE_BLUR's Gaussian sigma
+    float* kernel;  // Gaussian weights for STAGE_BLUR
+    char name[32];
+} Stage;
+
+typedef struct {
+    Stage stages[PIPELINE_MAX_STAGES];
+    int num_stages;
+    Image* src;
+    Image* dst;
+    _Atomic long stage_ns[PIPELINE_MAX_STAGES];  // Worker time per stage, summed over bands
+} Pipeline;
+
+static long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// Parse "blur:5,kuwahara:4" into stages, returns 0 on a malformed spec. A
+// blur stage may give its sigma after the radius, "blur:5/2.5".
+static int parse_pipeline(const char* spec, Pipeline* pipeline) {
+    pipeline->num_stages = 0;
+
+    while (*spec) {
+        const char* end = strchr(spec, ',');
+        size_t len = end ? (size_t)(end - spec) : strlen(spec);
+        if (pipeline->num_stages == PIPELINE_MAX_STAGES || len == 0 || len >= sizeof(pipeline->stages[0].name)) {
+            return 0;
+        }
+
+        Stage* stage = &pipeline->stages[pipeline->num_stages];
+        memcpy(stage->name, spec, len);
+        stage->name[len] = '\0';
+
+        char* colon = strchr(stage->name, ':');
+        if (!colon) return 0;
+        *colon = '\0';
+        stage->radius = atoi(colon + 1);
+        // Kuwahara's summed-area tables are exact only up to radius 256
+        if (stage->radius <= 0 || stage->radius > 256) return 0;
+        char* slash = strchr(colon + 1, '/');
+        stage->sigma = slash ? (float)atof(slash + 1) : gaussian_default_sigma(stage->radius);
+
+        if (strcmp(stage->name, "blur") == 0) {
+            stage->kind = STAGE_BLUR;
+            if (stage->sigma <= 0.0f) return 0;
+        } else if (strcmp(stage->name, "kuwahara") == 0 && !slash) {
+            stage->kind = STAGE_KUWAHARA;
+        } else {
+            return 0;
+        }
+        *colon = ':';
+        stage->kernel = NULL;
+
+        pipeline->num_stages++;
+        spec += len;
+        if (*spec == ',') spec++;
+    }
+
+    return pipeline->num_stages > 0;
+}
+
+// Wrap rows of a band buffer (or of src/dst) as an Image the stages can treat
+// as a standalone picture. Clamping at a view's top or bottom only happens where
+// the view touches the real image edge, since every other edge carries a full
+// halo, so filtering the view gives the same rows as filtering the image.
+// Band buffers are packed, views of src and dst keep the caller's stride.
+static Image band_view(unsigned char* data, int width, int rows, int channels, size_t stride) {
+    Image view = {
+        .data = data,
+        .width = width,
+        .height = rows,
+        .channels = channels,
+        .stride = stride
+    };
+    return view;
+}
+
+// Run every stage over output rows [y0, y1) of one band. Walking the stages
+// backwards gives the rows each stage must produce: its successor's rows
+// grown by the successor's radius and clipped to the image. Stage k reads
+// image rows [lo[k], hi[k]) and writes [lo[k + 1], hi[k + 1]).
+static void run_band(Pipeline* pipeline, int y0, int y1, unsigned char* buffers[2],
+                     Image* scratch, IntegralImage* integral) {
+    int n = pipeline->num_stages;
+    int w = pipeline->src->width;
+    int h = pipeline->src->height;
+    int cn = pipeline->src->channels;
+    size_t stride = (size_t)w * cn;
+    size_t src_stride = image_stride(pipeline->src);
+    size_t dst_stride = image_stride(pipeline->dst);
+    int lo[PIPELINE_MAX_STAGES + 1];
+    int hi[PIPELINE_MAX_STAGES + 1];
+
+    lo[n] = y0;
+    hi[n] = y1;
+    for (int k = n - 1; k >= 0; k--) {
+        int radius = pipeline->stages[k].radius;
+        lo[k] = (lo[k + 1] - radius > 0) ? lo[k + 1] - radius : 0;
+        hi[k] = (hi[k + 1] + radius < h) ? hi[k + 1] + radius : h;
+    }
+
+    Image in = band_view(image_row(pipeline->src, lo[0]), w, hi[0] - lo[0], cn, src_stride);
+
+    for (int k = 0; k < n; k++) {
+        Stage* stage = &pipeline->stages[k];
+        int rows = hi[k] - lo[k];
+        int out_begin = lo[k + 1] - lo[k];
+        int out_end = hi[k + 1] - lo[k];
+
+        // The last stage writes straight into dst, the others into a band buffer
+        int last = k == n - 1;
+        unsigned char* out_data = last ? image_row(pipeline->dst, lo[k]) : buffers[k % 2];
+        size_t out_stride = last ? dst_stride : stride;
+        Image out = band_view(out_data, w, rows, cn, out_stride);
+
+        long start = now_ns();
+        if (stage->kind == STAGE_BLUR) {
+            scratch->height = rows;
+            gaussian_blur_rows(&in, &out, scratch, stage->kernel, stage->radius, out_begin, out_end);
+        } else {
+            kuwahara_filter_band(&in, &out, integral, stage->radius, out_begin, out_end);
+        }
+        atomic_fetch_add_explicit(&pipeline->stage_ns[k], now_ns() - start, memory_order_relaxed);
+
+        in = band_view(out_data + out_begin * out_stride, w, hi[k + 1] - lo[k + 1], cn, out_stride);
+    }
+}
+
+void pipeline_worker(void* arg, int start_row, int end_row, int worker) {
+    (void)worker;
+    Pipeline* pipeline = (Pipeline*)arg;
+    int w = pipeline->src->width;
+    int h = pipeline->src->height;
+
+    int halo = 0;
+    for (int k = 0; k < pipeline->num_stages; k++) halo += pipeline->stages[k].radius;
+    int max_rows = PIPELINE_BAND_ROWS + 2 * halo;
+    if (max_rows > h) max_rows = h;
+
+    // Band intermediates, reused for every band of this tile
+    int cn = pipeline->src->channels;
+    size_t band_bytes = (size_t)w * max_rows * cn;
+    unsigned char* buffers[2] = {
+        (unsigned char*)malloc(band_bytes),
+        (unsigned char*)malloc(band_bytes)
+    };
+    Image scratch = band_view((unsigned char*)malloc(band_bytes), w, max_rows, cn, 0);
+    IntegralImage* integral = create_integral_image(w, h, max_rows, pipeline->src->channels);
+
+    for (int y0 = start_row; y0 < end_row; y0 += PIPELINE_BAND_ROWS) {
+        int y1 = (y0 + PIPELINE_BAND_ROWS < end_row) ? y0 + PIPELINE_BAND_ROWS : end_row;
+        run_band(pipeline, y0, y1, buffers, &scratch, integral);
+    }
+
+    free(buffers[0]);
+    free(buffers[1]);
+    free(scratch.data);
+    free_integral_image(integral);
+}
+
+// Run a chain of filters tile by tile: each band of the output pulls its rows
+// through every stage before the next band starts, so intermediates never
+// exist at full-frame size. Fills stats, if given, with each stage's worker
+// time. Returns 0 if the spec cannot be parsed.
+int run_pipeline(Image* src, Image* dst, const char* spec, PipelineStats* stats, ThreadPool* pool) {
+    Pipeline pipeline = {
+        .src = src,
+        .dst = dst
+    };
+    if (!parse_pipeline(spec, &pipeline)) {
+        fprintf(stderr, "Invalid pipeline: %s (expected e.g. blur:5,kuwahara:4 or blur:5/2.5)\n", spec);
+        return 0;
+    }
+
+    for (int k = 0; k < pipeline.num_stages; k++) {
+        atomic_init(&pipeline.stage_ns[k], 0);
+        if (pipeline.stages[k].kind == STAGE_BLUR) {
+            pipeline.stages[k].kernel = gaussian_kernel_acquire(pipeline.stages[k].radius,
+                                                                pipeline.stages[k].sigma);
+        }
+    }
+
+    thread_pool_set_phase(pool, "pipeline");
+    thread_pool_for(pool, src->height, pipeline_worker, &pipeline);
+
+    if (stats) stats->num_stages = pipeline.num_stages;
+    for (int k = 0; k < pipeline.num_stages; k++) {
+        if (stats) {
+            memcpy(stats->names[k], pipeline.stages[k].name, sizeof(stats->names[k]));
+            stats->stage_ns[k] = atomic_load(&pipeline.stage_ns[k]);
+        }
+        gaussian_kernel_release(pipeline.stages[k].kernel);
+    }
+
+    return 1;
+}
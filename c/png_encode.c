@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <zlib.h>
+
+#include "filter.h"
+
+typedef void (*PoolTaskFn)(void* arg, int worker);
+typedef void (*PoolRangeFn)(void* arg, int begin, int end, int worker);
+
+// External functions from thread_pool.c
+void thread_pool_run(ThreadPool* pool, PoolTaskFn task, void* arg);
+void thread_pool_for(ThreadPool* pool, int count, PoolRangeFn body, void* arg);
+void thread_pool_set_phase(ThreadPool* pool, const char* name);
+
+// Filtered bytes deflated per strip. Strips are compressed independently, each
+// primed with the preceding 32 KB as its dictionary, so compression stays
+// close to a single stream.
+#define PNG_STRIP_BYTES (256 * 1024)
+#define PNG_WINDOW (32 * 1024)
+
+typedef struct {
+    unsigned char* out;
+    size_t out_len;
+    uLong adler;
+    uLong crc;
+    int ok;
+} PngStrip;
+
+typedef struct {
+    Image* img;
+    size_t row_bytes;       // Filter byte plus the pixels of one row
+    unsigned char* filtered;
+    PngFilter filter;
+    int level;
+
+    PngStrip* strips;
+    int num_strips;
+    int rows_per_strip;
+    _Atomic int next_strip;
+} PngJob;
+
+static unsigned char paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+    if (pa <= pb && pa <= pc) return (unsigned char)a;
+    if (pb <= pc) return (unsigned char)b;
+    return (unsigned char)c;
+}
+
+// Apply one filter type to a row. prev is NULL for the first row.
+static void filter_row(unsigned char* out, const unsigned char* row, const unsigned char* prev,
+                       int len, int bpp, PngFilter filter) {
+    for (int i = 0; i < len; i++) {
+        int a = i >= bpp ? row[i - bpp] : 0;
+        int b = prev ? prev[i] : 0;
+        int c = (prev && i >= bpp) ? prev[i - bpp] : 0;
+        switch (filter) {
+            case PNG_FILTER_SUB: out[i] = (unsigned char)(row[i] - a); break;
+            case PNG_FILTER_UP: out[i] = (unsigned char)(row[i] - b); break;
+            case PNG_FILTER_AVERAGE: out[i] = (unsigned char)(row[i] - ((a + b) >> 1)); break;
+            case PNG_FILTER_PAETH: out[i] = (unsigned char)(row[i] - paeth(a, b, c)); break;
+            default: out[i] = row[i]; break;
+        }
+    }
+}
+
+static long filter_cost(const unsigned char* out, int len) {
+    long cost = 0;
+    for (int i = 0; i < len; i++) {
+        cost += abs((signed char)out[i]);
+    }
+    return cost;
+}
+
+void png_filter_worker(void* arg, int start_row, int end_row, int worker) {
+    (void)worker;
+    PngJob* job = (PngJob*)arg;
+    Image* img = job->img;
+    int len = img->width * img->channels;
+    int bpp = img->channels;
+    unsigned char* trial = job->filter == PNG_FILTER_ADAPTIVE ? (unsigned char*)malloc(len) : NULL;
+
+    for (int y = start_row; y < end_row; y++) {
+        const unsigned char* row = image_row(img, y);
+        const unsigned char* prev = y > 0 ? image_row(img, y - 1) : NULL;
+        unsigned char* out = job->filtered + (size_t)y * job->row_bytes;
+
+        if (job->filter != PNG_FILTER_ADAPTIVE) {
+            out[0] = (unsigned char)job->filter;
+            filter_row(out + 1, row, prev, len, bpp, job->filter);
+            continue;
+        }
+
+        long best_cost = -1;
+        for (int f = PNG_FILTER_NONE; f <= PNG_FILTER_PAETH; f++) {
+            filter_row(trial, row, prev, len, bpp, (PngFilter)f);
+            long cost = filter_cost(trial, len);
+            if (best_cost < 0 || cost < best_cost) {
+                best_cost = cost;
+                out[0] = (unsigned char)f;
+                memcpy(out + 1, trial, len);
+            }
+        }
+    }
+
+    free(trial);
+}
+
+// Deflate one strip as raw deflate blocks. Every strip but the last ends with
+// a sync flush (an empty stored block), so the strips concatenate into one
+// valid stream; the last one carries the final block.
+static void compress_strip(PngJob* job, int index) {
+    PngStrip* strip = &job->strips[index];
+    size_t begin = (size_t)index * job->rows_per_strip * job->row_bytes;
+    size_t end = begin + (size_t)job->rows_per_strip * job->row_bytes;
+    size_t total = (size_t)job->img->height * job->row_bytes;
+    if (end > total) end = total;
+    int last = index == job->num_strips - 1;
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, job->level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        strip->ok = 0;
+        return;
+    }
+    if (begin > 0) {
+        size_t dict = begin < PNG_WINDOW ? begin : PNG_WINDOW;
+        deflateSetDictionary(&zs, job->filtered + begin - dict, (uInt)dict);
+    }
+
+    size_t capacity = deflateBound(&zs, end - begin) + 16;
+    strip->out = (unsigned char*)malloc(capacity);
+    zs.next_in = job->filtered + begin;
+    zs.avail_in = (uInt)(end - begin);
+    zs.next_out = strip->out;
+    zs.avail_out = (uInt)capacity;
+
+    int ret = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+    strip->ok = last ? ret == Z_STREAM_END : (ret == Z_OK && zs.avail_in == 0 && zs.avail_out > 0);
+    strip->out_len = capacity - zs.avail_out;
+    deflateEnd(&zs);
+
+    strip->adler = adler32(1L, job->filtered + begin, (uInt)(end - begin));
+    strip->crc = crc32(0L, strip->out, (uInt)strip->out_len);
+}
+
+static void png_compress_worker(void* arg, int worker) {
+    (void)worker;
+    PngJob* job = (PngJob*)arg;
+    int index;
+    while ((index = atomic_fetch_add(&job->next_strip, 1)) < job->num_strips) {
+        compress_strip(job, index);
+    }
+}
+
+static void put_u32(unsigned char* p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static int write_chunk(FILE* f, const char* type, const unsigned char* data, uint32_t len) {
+    unsigned char header[8];
+    unsigned char trailer[4];
+    put_u32(header, len);
+    memcpy(header + 4, type, 4);
+    uLong crc = crc32(0L, (const Bytef*)type, 4);
+    if (len > 0) crc = crc32(crc, data, len);
+    put_u32(trailer, (uint32_t)crc);
+    return fwrite(header, 1, 8, f) == 8 && (len == 0 || fwrite(data, 1, len, f) == len) &&
+           fwrite(trailer, 1, 4, f) == 4;
+}
+
+// zlib stream header (RFC 1950) for a 32 KB window, FLEVEL hinting the level
+static void zlib_header(unsigned char* out, int level) {
+    int flevel = level < 2 ? 0 : (level < 6 ? 1 : (level == 6 ? 2 : 3));
+    int cmf = 0x78;
+    int flg = flevel << 6;
+    flg += (31 - (cmf * 256 + flg) % 31) % 31;
+    out[0] = (unsigned char)cmf;
+    out[1] = (unsigned char)flg;
+}
+
+// Encode img as PNG with strips filtered and deflated on the pool (serially if
+// pool is NULL). level is the zlib level 0-9. Returns 0 on failure.
+int save_png(const char* filename, Image* img, int level, PngFilter filter, ThreadPool* pool) {
+    static const unsigned char color_types[5] = {0, 0, 4, 2, 6};
+    if (img->channels < 1 || img->channels > 4) return 0;
+    if (level < 0) level = 0;
+    if (level > 9) level = 9;
+
+    PngJob job = {
+        .img = img,
+        .row_bytes = (size_t)img->width * img->channels + 1,
+        .filter = filter,
+        .level = level
+    };
+    job.filtered = (unsigned char*)malloc(job.row_bytes * img->height);
+    job.rows_per_strip = (int)(PNG_STRIP_BYTES / job.row_bytes);
+    if (job.rows_per_strip < 1) job.rows_per_strip = 1;
+    job.num_strips = (img->height + job.rows_per_strip - 1) / job.rows_per_strip;
+    job.strips = (PngStrip*)calloc(job.num_strips, sizeof(PngStrip));
+    atomic_init(&job.next_strip, 0);
+
+    // Filtering reads the raw previous row only, so every row is independent.
+    // Compression needs the filtered bytes before each strip for its
+    // dictionary, hence the two passes.
+    if (pool) {
+        thread_pool_set_phase(pool, "png_filter");
+        thread_pool_for(pool, img->height, png_filter_worker, &job);
+        thread_pool_set_phase(pool, "png_deflate");
+        thread_pool_run(pool, png_compress_worker, &job);
+    } else {
+        png_filter_worker(&job, 0, img->height, 0);
+        png_compress_worker(&job, 0);
+    }
+
+    // Stitch: zlib header, strips in order, Adler-32 of all filtered bytes.
+    // The IDAT CRC and Adler-32 are combined from the per-strip values.
+    int ok = 1;
+    size_t idat_len = 6;
+    unsigned char zhead[2];
+    unsigned char ztail[4];
+    zlib_header(zhead, level);
+    uLong crc = crc32(0L, (const Bytef*)"IDAT", 4);
+    crc = crc32(crc, zhead, 2);
+    uLong adler = 1L;
+    for (int i = 0; i < job.num_strips; i++) {
+        PngStrip* strip = &job.strips[i];
+        ok = ok && strip->ok;
+        size_t in_len = (i == job.num_strips - 1)
+            ? job.row_bytes * img->height - (size_t)i * job.rows_per_strip * job.row_bytes
+            : (size_t)job.rows_per_strip * job.row_bytes;
+        adler = adler32_combine(adler, strip->adler, (z_off_t)in_len);
+        crc = crc32_combine(crc, strip->crc, (z_off_t)strip->out_len);
+        idat_len += strip->out_len;
+    }
+    put_u32(ztail, (uint32_t)adler);
+    crc = crc32(crc, ztail, 4);
+
+    FILE* f = ok && idat_len <= 0x7FFFFFFF ? fopen(filename, "wb") : NULL;
+    if (f) {
+        static const unsigned char signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+        unsigned char ihdr[13];
+        put_u32(ihdr, (uint32_t)img->width);
+        put_u32(ihdr + 4, (uint32_t)img->height);
+        ihdr[8] = 8;
+        ihdr[9] = color_types[img->channels];
+        ihdr[10] = 0;
+        ihdr[11] = 0;
+        ihdr[12] = 0;
+
+        unsigned char header[8];
+        unsigned char trailer[4];
+        put_u32(header, (uint32_t)idat_len);
+        memcpy(header + 4, "IDAT", 4);
+        put_u32(trailer, (uint32_t)crc);
+
+        ok = fwrite(signature, 1, 8, f) == 8 && write_chunk(f, "IHDR", ihdr, 13);
+        ok = ok && fwrite(header, 1, 8, f) == 8 && fwrite(zhead, 1, 2, f) == 2;
+        for (int i = 0; ok && i < job.num_strips; i++) {
+            ok = fwrite(job.strips[i].out, 1, job.strips[i].out_len, f) == job.strips[i].out_len;
+        }
+        ok = ok && fwrite(ztail, 1, 4, f) == 4 && fwrite(trailer, 1, 4, f) == 4;
+        ok = ok && write_chunk(f, "IEND", NULL, 0);
+        ok = (fclose(f) == 0) && ok;
+    } else {
+        ok = 0;
+    }
+
+    for (int i = 0; i < job.num_strips; i++) {
+        free(job.strips[i].out);
+    }
+    free(job.strips);
+    free(job.filtered);
+    return ok;
+}
@@ -0,0 +1,597 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "filter.h"
+
+// Task run on every worker by thread_pool_run, worker is in [0, num_workers)
+typedef void (*PoolTaskFn)(void* arg, int worker);
+
+// Loop body run by thread_pool_for on items [begin, end) of one tile
+typedef void (*PoolRangeFn)(void* arg, int begin, int end, int worker);
+
+// Tiles handed out per worker when no grain is configured
+#define POOL_TILES_PER_WORKER 4
+
+// Scratch buffers owned by the pool, see thread_pool_buffer
+#define POOL_BUFFER_SLOTS 8
+#define POOL_BUFFER_ALIGN 64
+#define POOL_HUGE_PAGE (2 * 1024 * 1024)
+
+// Bytes zeroed per item by thread_pool_first_touch
+#define POOL_TOUCH_BYTES 4096
+
+// Distinct phase names recorded by the profiler, see thread_pool_set_phase
+#define POOL_MAX_PHASES 32
+
+// Hardware counters read around every task when profiling with counters
+enum {
+    POOL_COUNTER_CYCLES,
+    POOL_COUNTER_LLC_MISSES,
+    POOL_COUNTERS
+};
+
+// Totals of one named phase. Worker slots are written only by their worker.
+typedef struct {
+    const char* name;
+    long calls;
+    long wall_ns;
+    long* busy_ns;                     // Per worker
+    uint64_t* counts[POOL_COUNTERS];   // Per worker
+} PoolPhase;
+
+// Per-worker deque of tile indices. The remaining range [head, tail) is packed
+// into one word so the owner (popping from head) and thieves (splitting off
+// the tail half) update it with a single compare-and-swap. A tile index only
+// ever leaves a range, so a stale range can never compare equal again.
+typedef struct {
+    _Atomic uint64_t range;
+    char pad[64 - sizeof(uint64_t)];
+} TileDeque;
+
+typedef struct {
+    ThreadPool* pool;
+    int id;
+    int perf_fds[POOL_COUNTERS];  // -2 until opened, -1 if unavailable
+} PoolWorker;
+
+struct ThreadPool {
+    pthread_t* threads;
+    PoolWorker* workers;
+    int num_workers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+
+    // Current job, guarded by lock
+    PoolTaskFn task;
+    void* arg;
+    unsigned long generation;
+    int pending;
+    int shutdown;
+    int phase;  // Profile phase of the current job, -1 when not profiling
+    long job_start_ns;
+
+    // Work-stealing state for thread_pool_for
+    TileDeque* deques;
+    int grain;
+
+    // Scratch arena, only touched by the thread driving the pool
+    void* buffers[POOL_BUFFER_SLOTS];
+    size_t buffer_sizes[POOL_BUFFER_SLOTS];
+    int huge_pages;
+
+    // Profiler, see thread_pool_enable_profile
+    int profiling;
+    int counters;
+    PoolPhase phases[POOL_MAX_PHASES];
+    int num_phases;
+    int current_phase;
+};
+
+typedef struct {
+    int cpu;
+    int package;
+    int core;
+    int rank;  // Position within its package, used to interleave packages
+} CpuInfo;
+
+typedef struct {
+    ThreadPool* pool;
+    PoolRangeFn body;
+    void* arg;
+    int count;
+    int grain;
+} TileLoop;
+
+static uint64_t pack_range(uint32_t head, uint32_t tail) {
+    return ((uint64_t)tail << 32) | head;
+}
+
+static uint32_t range_head(uint64_t range) { return (uint32_t)range; }
+static uint32_t range_tail(uint64_t range) { return (uint32_t)(range >> 32); }
+
+static long pool_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// Open this thread's counters. perf_event_open is often restricted (see
+// perf_event_paranoid), in which case the counters are reported as null.
+static void open_counters(PoolWorker* self) {
+    static const uint64_t configs[POOL_COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_CACHE_MISSES
+    };
+    for (int c = 0; c < POOL_COUNTERS; c++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[c];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        self->perf_fds[c] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+}
+
+static uint64_t read_counter(int fd) {
+    uint64_t value = 0;
+    if (fd < 0 || read(fd, &value, sizeof(value)) != sizeof(value)) return 0;
+    return value;
+}
+
+// Run a task, charging its time and counter deltas to a profile phase
+static void run_profiled(PoolWorker* self, PoolTaskFn task, void* task_arg, int phase) {
+    ThreadPool* pool = self->pool;
+    uint64_t before[POOL_COUNTERS] = {0};
+
+    if (pool->counters) {
+        if (self->perf_fds[0] == -2) open_counters(self);
+        for (int c = 0; c < POOL_COUNTERS; c++) before[c] = read_counter(self->perf_fds[c]);
+    }
+    long start = pool_now_ns();
+
+    task(task_arg, self->id);
+
+    PoolPhase* p = &pool->phases[phase];
+    p->busy_ns[self->id] += pool_now_ns() - start;
+    if (pool->counters) {
+        for (int c = 0; c < POOL_COUNTERS; c++) {
+            p->counts[c][self->id] += read_counter(self->perf_fds[c]) - before[c];
+        }
+    }
+}
+
+static void* pool_worker_main(void* arg) {
+    PoolWorker* self = (PoolWorker*)arg;
+    ThreadPool* pool = self->pool;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        // Park until a new job is published or the pool shuts down
+        while (!pool->shutdown && pool->generation == seen) {
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        }
+        if (pool->shutdown) break;
+
+        seen = pool->generation;
+        PoolTaskFn task = pool->task;
+        void* task_arg = pool->arg;
+        int phase = pool->phase;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (phase >= 0) {
+            run_profiled(self, task, task_arg, phase);
+        } else {
+            task(task_arg, self->id);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0) {
+            pthread_cond_signal(&pool->work_done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+ThreadPool* thread_pool_create(int num_workers) {
+    if (num_workers <= 0) num_workers = 1;
+
+    ThreadPool* pool = (ThreadPool*)calloc(1, sizeof(ThreadPool));
+    pool->num_workers = num_workers;
+    pool->threads = (pthread_t*)malloc(num_workers * sizeof(pthread_t));
+    pool->workers = (PoolWorker*)malloc(num_workers * sizeof(PoolWorker));
+    pool->deques = (TileDeque*)aligned_alloc(64, num_workers * sizeof(TileDeque));
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+
+    for (int i = 0; i < num_workers; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].id = i;
+        for (int c = 0; c < POOL_COUNTERS; c++) pool->workers[i].perf_fds[c] = -2;
+        pthread_create(&pool->threads[i], NULL, pool_worker_main, &pool->workers[i]);
+    }
+
+    return pool;
+}
+
+void thread_pool_destroy(ThreadPool* pool) {
+    if (!pool) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->num_workers; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_cond_destroy(&pool->work_done);
+    for (int i = 0; i < POOL_BUFFER_SLOTS; i++) {
+        free(pool->buffers[i]);
+    }
+    for (int i = 0; i < pool->num_workers; i++) {
+        for (int c = 0; c < POOL_COUNTERS; c++) {
+            if (pool->workers[i].perf_fds[c] >= 0) close(pool->workers[i].perf_fds[c]);
+        }
+    }
+    for (int i = 0; i < pool->num_phases; i++) {
+        free(pool->phases[i].busy_ns);
+        for (int c = 0; c < POOL_COUNTERS; c++) free(pool->phases[i].counts[c]);
+    }
+    free(pool->threads);
+    free(pool->workers);
+    free(pool->deques);
+    free(pool);
+}
+
+int thread_pool_size(ThreadPool* pool) {
+    return pool->num_workers;
+}
+
+// Publish task(arg, worker) to every worker and return without waiting. The
+// caller may poll shared state while the job runs, but must call
+// thread_pool_wait before starting another job.
+void thread_pool_begin(ThreadPool* pool, PoolTaskFn task, void* arg) {
+    int phase = pool->profiling ? pool->current_phase : -1;
+    pool->job_start_ns = phase >= 0 ? pool_now_ns() : 0;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->arg = arg;
+    pool->phase = phase;
+    pool->pending = pool->num_workers;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Block until every worker has finished the job started by thread_pool_begin
+void thread_pool_wait(ThreadPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->work_done, &pool->lock);
+    }
+    int phase = pool->phase;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (phase >= 0) {
+        pool->phases[phase].calls++;
+        pool->phases[phase].wall_ns += pool_now_ns() - pool->job_start_ns;
+    }
+}
+
+// Fork/join: run task(arg, worker) once on every worker and wait for all of them
+void thread_pool_run(ThreadPool* pool, PoolTaskFn task, void* arg) {
+    thread_pool_begin(pool, task, arg);
+    thread_pool_wait(pool);
+}
+
+// Rows (or other items) per tile used by thread_pool_for, 0 picks automatically
+void thread_pool_set_grain(ThreadPool* pool, int grain) {
+    pool->grain = grain < 0 ? 0 : grain;
+}
+
+// Take the next tile from the front of our own deque
+static int deque_pop(TileDeque* deque, uint32_t* tile) {
+    uint64_t range = atomic_load_explicit(&deque->range, memory_order_acquire);
+    for (;;) {
+        uint32_t head = range_head(range);
+        uint32_t tail = range_tail(range);
+        if (head >= tail) return 0;
+        if (atomic_compare_exchange_weak_explicit(&deque->range, &range, pack_range(head + 1, tail),
+                                                  memory_order_acq_rel, memory_order_acquire)) {
+            *tile = head;
+            return 1;
+        }
+    }
+}
+
+// Steal the back half of another worker's deque into our own (empty) deque
+static int deque_steal(ThreadPool* pool, int self) {
+    for (int i = 1; i < pool->num_workers; i++) {
+        TileDeque* victim = &pool->deques[(self + i) % pool->num_workers];
+        uint64_t range = atomic_load_explicit(&victim->range, memory_order_acquire);
+        for (;;) {
+            uint32_t head = range_head(range);
+            uint32_t tail = range_tail(range);
+            if (head >= tail) break;
+
+            uint32_t mid = head + (tail - head) / 2;
+            if (atomic_compare_exchange_weak_explicit(&victim->range, &range, pack_range(head, mid),
+                                                      memory_order_acq_rel, memory_order_acquire)) {
+                atomic_store_explicit(&pool->deques[self].range, pack_range(mid, tail),
+                                      memory_order_release);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void tile_loop_worker(void* arg, int worker) {
+    TileLoop* loop = (TileLoop*)arg;
+    TileDeque* own = &loop->pool->deques[worker];
+    uint32_t tile;
+
+    for (;;) {
+        while (deque_pop(own, &tile)) {
+            int begin = (int)tile * loop->grain;
+            int end = begin + loop->grain;
+            if (end > loop->count) end = loop->count;
+            loop->body(loop->arg, begin, end, worker);
+        }
+        if (!deque_steal(loop->pool, worker)) break;
+    }
+}
+
+// Parallel loop over [0, count) split into tiles of the pool's grain. Each
+// worker starts on a contiguous share of the tiles and steals from the others
+// once it runs dry. Must not be called from inside a pool task.
+void thread_pool_for(ThreadPool* pool, int count, PoolRangeFn body, void* arg) {
+    if (count <= 0) return;
+
+    int num_workers = pool->num_workers;
+    int grain = pool->grain;
+    if (grain == 0) {
+        grain = count / (num_workers * POOL_TILES_PER_WORKER);
+        if (grain < 1) grain = 1;
+    }
+    int num_tiles = (count + grain - 1) / grain;
+
+    for (int i = 0; i < num_workers; i++) {
+        uint32_t head = (uint32_t)((long)num_tiles * i / num_workers);
+        uint32_t tail = (uint32_t)((long)num_tiles * (i + 1) / num_workers);
+        atomic_store_explicit(&pool->deques[i].range, pack_range(head, tail), memory_order_relaxed);
+    }
+
+    TileLoop loop = {
+        .pool = pool,
+        .body = body,
+        .arg = arg,
+        .count = count,
+        .grain = grain
+    };
+    thread_pool_run(pool, tile_loop_worker, &loop);
+}
+
+// Charge the following jobs to the phase called name (a string literal, it is
+// kept by pointer). A no-op unless profiling is enabled.
+void thread_pool_set_phase(ThreadPool* pool, const char* name) {
+    if (!pool->profiling) return;
+
+    for (int i = 0; i < pool->num_phases; i++) {
+        if (strcmp(pool->phases[i].name, name) == 0) {
+            pool->current_phase = i;
+            return;
+        }
+    }
+    if (pool->num_phases == POOL_MAX_PHASES) {
+        pool->current_phase = 0;
+        return;
+    }
+
+    PoolPhase* phase = &pool->phases[pool->num_phases];
+    phase->name = name;
+    phase->busy_ns = (long*)calloc(pool->num_workers, sizeof(long));
+    for (int c = 0; c < POOL_COUNTERS; c++) {
+        phase->counts[c] = (uint64_t*)calloc(pool->num_workers, sizeof(uint64_t));
+    }
+    pool->current_phase = pool->num_phases++;
+}
+
+// Start recording per-phase wall time and per-worker busy time for every
+// job, plus cycle and LLC-miss counters if counters is set
+void thread_pool_enable_profile(ThreadPool* pool, int counters) {
+    pool->profiling = 1;
+    pool->counters = counters;
+    thread_pool_set_phase(pool, "other");
+}
+
+static int read_topology(int cpu, const char* name) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+    FILE* f = fopen(path, "r");
+    int value = 0;
+    if (f) {
+        if (fscanf(f, "%d", &value) != 1) value = 0;
+        fclose(f);
+    }
+    return value;
+}
+
+static int compare_compact(const void* a, const void* b) {
+    const CpuInfo* x = (const CpuInfo*)a;
+    const CpuInfo* y = (const CpuInfo*)b;
+    if (x->package != y->package) return x->package - y->package;
+    if (x->core != y->core) return x->core - y->core;
+    return x->cpu - y->cpu;
+}
+
+static int compare_scatter(const void* a, const void* b) {
+    const CpuInfo* x = (const CpuInfo*)a;
+    const CpuInfo* y = (const CpuInfo*)b;
+    if (x->rank != y->rank) return x->rank - y->rank;
+    return x->package - y->package;
+}
+
+// Pin worker i to the i-th CPU of the placement order, wrapping around when
+// there are more workers than CPUs. Orders are built from the CPUs the
+// process may run on and their socket/core ids in sysfs. Returns 0 if
+// pinning failed.
+int thread_pool_set_affinity(ThreadPool* pool, PoolAffinity mode) {
+    if (mode == POOL_AFFINITY_NONE) return 1;
+
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return 0;
+
+    int num_cpus = CPU_COUNT(&allowed);
+    CpuInfo* cpus = (CpuInfo*)malloc(num_cpus * sizeof(CpuInfo));
+    int n = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE && n < num_cpus; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        cpus[n].cpu = cpu;
+        cpus[n].package = read_topology(cpu, "physical_package_id");
+        cpus[n].core = read_topology(cpu, "core_id");
+        n++;
+    }
+
+    // Compact order first, its position within each package is the rank
+    qsort(cpus, n, sizeof(CpuInfo), compare_compact);
+    for (int i = 0; i < n; i++) {
+        cpus[i].rank = (i > 0 && cpus[i - 1].package == cpus[i].package) ? cpus[i - 1].rank + 1 : 0;
+    }
+    if (mode == POOL_AFFINITY_SCATTER) {
+        qsort(cpus, n, sizeof(CpuInfo), compare_scatter);
+    }
+
+    int ok = 1;
+    for (int i = 0; i < pool->num_workers; i++) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpus[i % n].cpu, &set);
+        if (pthread_setaffinity_np(pool->threads[i], sizeof(set), &set) != 0) ok = 0;
+    }
+
+    free(cpus);
+    return ok;
+}
+
+static void first_touch_worker(void* arg, int begin, int end, int worker) {
+    (void)worker;
+    unsigned char* buffer = (unsigned char*)arg;
+    memset(buffer + (size_t)begin * POOL_TOUCH_BYTES, 0, (size_t)(end - begin) * POOL_TOUCH_BYTES);
+}
+
+// Zero a fresh buffer from the workers, in the same contiguous per-worker
+// shares thread_pool_for hands out for row loops. Pages are then placed on
+// the NUMA node of the worker that will mostly write them. size is rounded
+// down to whole touch units; the tail is zeroed by the caller's thread.
+void thread_pool_first_touch(ThreadPool* pool, void* buffer, size_t size) {
+    int units = (int)(size / POOL_TOUCH_BYTES);
+    size_t tail = size - (size_t)units * POOL_TOUCH_BYTES;
+
+    // Automatic tiles so each worker's share matches a row loop's share
+    int grain = pool->grain;
+    int phase = pool->current_phase;
+    pool->grain = 0;
+    thread_pool_set_phase(pool, "first_touch");
+    thread_pool_for(pool, units, first_touch_worker, buffer);
+    pool->grain = grain;
+    pool->current_phase = phase;
+
+    memset((unsigned char*)buffer + (size - tail), 0, tail);
+}
+
+// Back scratch buffers with transparent huge pages where the kernel allows it.
+// Applies to buffers allocated (or grown) after the call.
+void thread_pool_set_huge_pages(ThreadPool* pool, int enabled) {
+    pool->huge_pages = enabled;
+}
+
+// Scratch buffer number slot of at least size bytes, 64-byte aligned. The
+// buffer is kept across calls and only reallocated when a larger size is
+// asked for, so filters run repeatedly on same-sized images allocate nothing.
+// New buffers are first touched by the workers, other contents are
+// unspecified. Valid until the slot is requested again with a larger size or
+// the pool is destroyed.
+void* thread_pool_buffer(ThreadPool* pool, int slot, size_t size) {
+    if (slot < 0 || slot >= POOL_BUFFER_SLOTS) return NULL;
+    if (size <= pool->buffer_sizes[slot]) return pool->buffers[slot];
+
+    size_t align = pool->huge_pages ? POOL_HUGE_PAGE : POOL_BUFFER_ALIGN;
+    size_t rounded = (size + align - 1) / align * align;
+
+    free(pool->buffers[slot]);
+    void* buffer = aligned_alloc(align, rounded);
+    if (buffer && pool->huge_pages) {
+        madvise(buffer, rounded, MADV_HUGEPAGE);
+    }
+    if (buffer) {
+        thread_pool_first_touch(pool, buffer, rounded);
+    }
+    pool->buffers[slot] = buffer;
+    pool->buffer_sizes[slot] = buffer ? rounded : 0;
+    return buffer;
+}
+
+// Write the recorded phases as JSON. A worker's idle time is the phase's wall
+// time minus its busy time: waiting for the job to start, for steals that
+// found nothing, and for the slowest worker to finish. Returns 0 on failure.
+int thread_pool_write_profile(ThreadPool* pool, const char* filename) {
+    FILE* f = fopen(filename, "w");
+    if (!f) return 0;
+
+    static const char* counter_names[POOL_COUNTERS] = {"cycles", "llc_misses"};
+    fprintf(f, "{\n  \"workers\": %d,\n  \"phases\": [", pool->num_workers);
+
+    int first = 1;
+    for (int i = 0; i < pool->num_phases; i++) {
+        PoolPhase* phase = &pool->phases[i];
+        if (phase->calls == 0) continue;
+
+        fprintf(f, "%s\n    {\"name\": \"%s\", \"calls\": %ld, \"wall_us\": %ld, \"workers\": [",
+                first ? "" : ",", phase->name, phase->calls, phase->wall_ns / 1000);
+        first = 0;
+
+        for (int w = 0; w < pool->num_workers; w++) {
+            long busy = phase->busy_ns[w];
+            long idle = phase->wall_ns - busy;
+            fprintf(f, "%s\n      {\"busy_us\": %ld, \"idle_us\": %ld", w ? "," : "",
+                    busy / 1000, (idle > 0 ? idle : 0) / 1000);
+            for (int c = 0; c < POOL_COUNTERS; c++) {
+                if (pool->counters && pool->workers[w].perf_fds[c] >= 0) {
+                    fprintf(f, ", \"%s\": %llu", counter_names[c], (unsigned long long)phase->counts[c][w]);
+                } else {
+                    fprintf(f, ", \"%s\": null", counter_names[c]);
+                }
+            }
+            fprintf(f, "}");
+        }
+        fprintf(f, "\n    ]}");
+    }
+    fprintf(f, "\n  ]\n}\n");
+
+    return fclose(f) == 0;
+}